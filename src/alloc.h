@@ -34,6 +34,8 @@
 
 #include "error.h"
 
+#include <stdint.h>
+
 
 /**
    Allocates a block of uninitialized memory on the heap
@@ -115,6 +117,77 @@ static inline void * l3roamd_realloc(void *ptr, size_t size) {
 #define l3roamd_new0_array(members, type) ((type *)l3roamd_alloc0_array(members, sizeof(type)))
 
 
+/**
+   A pool of fixed-size objects
+
+   Objects are carved out of chunks and recycled through a freelist instead of
+   being returned to the heap, so allocating objects that are freed and
+   allocated again at a high rate does not involve malloc(). Chunks are kept
+   until the process exits; \e high_water tells how many objects were in use
+   at the same time.
+*/
+typedef struct l3roamd_pool {
+	const char *name;
+	size_t elemsize;	/**< The size of an object, a multiple of 16 bytes */
+	size_t chunklen;	/**< The number of objects allocated at once */
+	void *freelist;		/**< Free objects, each storing a pointer to the next one */
+	size_t in_use;
+	size_t high_water;
+	size_t allocated;	/**< The number of objects allocated from the heap */
+} l3roamd_pool_t;
+
+/** Initializes an empty pool for objects of \e elemsize bytes, growing by \e chunklen objects */
+static inline void l3roamd_pool_init(l3roamd_pool_t *pool, const char *name, size_t elemsize, size_t chunklen) {
+	if (elemsize < sizeof(void *))
+		elemsize = sizeof(void *);
+
+	pool->name = name;
+	pool->elemsize = (elemsize + 15) & ~(size_t)15;
+	pool->chunklen = chunklen;
+	pool->freelist = NULL;
+	pool->in_use = 0;
+	pool->high_water = 0;
+	pool->allocated = 0;
+}
+
+/**
+   Allocates an uninitialized object from a pool, aligned to 16 bytes
+
+   Terminates the process on failure.
+*/
+static inline void * l3roamd_pool_alloc(l3roamd_pool_t *pool) {
+	if (!pool->freelist) {
+		uint8_t *chunk = l3roamd_alloc_aligned(pool->chunklen * pool->elemsize, 16);
+
+		for (size_t i = pool->chunklen; i > 0; i--) {
+			void *elem = chunk + (i - 1) * pool->elemsize;
+			*(void **)elem = pool->freelist;
+			pool->freelist = elem;
+		}
+
+		pool->allocated += pool->chunklen;
+	}
+
+	void *ret = pool->freelist;
+	pool->freelist = *(void **)ret;
+
+	if (++pool->in_use > pool->high_water)
+		pool->high_water = pool->in_use;
+
+	return ret;
+}
+
+/** Returns an object to the pool it was allocated from (object may be NULL) */
+static inline void l3roamd_pool_free(l3roamd_pool_t *pool, void *elem) {
+	if (!elem)
+		return;
+
+	*(void **)elem = pool->freelist;
+	pool->freelist = elem;
+	pool->in_use--;
+}
+
+
 /** Duplicates a string (string may be NULL) */
 static inline char * l3roamd_strdup(const char *s) {
 	if (!s)
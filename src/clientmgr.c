@@ -210,19 +210,88 @@ void remove_special_ip ( clientmgr_ctx *ctx, struct client *client )
 	client->node_ip_initialized = false;
 }
 
+/** Position of an address of a local client, stored in the address index.
+  */
+struct client_ip_ref {
+	client_handle_t client;
+	size_t slot;
+};
+
+/** Make an IP address of a local client known to the address index.
+  If the address was assigned to a different client before, it is now assigned to this one.
+  */
+static void index_client_ip ( clientmgr_ctx *ctx, struct client *client, struct client_ip *ip )
+{
+	struct client_ip_ref ref = {
+		.client = client->handle,
+		.slot = ip - VECTOR_DATA ( client->addresses ),
+	};
+
+	hashmap_put ( &ctx->address_index, &ip->addr, &ref );
+}
+
+/** Return the index entry of an address if it belongs to the given client.
+  */
+static struct client_ip_ref *find_client_ip_ref ( clientmgr_ctx *ctx, struct client *client, const struct in6_addr *address )
+{
+	struct client_ip_ref *ref = hashmap_get ( &ctx->address_index, address );
+
+	if ( ref && !SLAB_HANDLE_EQ ( ref->client, client->handle ) )
+		return NULL;
+
+	return ref;
+}
+
+/** Return the position of an address in the address list of a client or -1 if the client does not have it.
+  Addresses in the address index are found without searching the list.
+  */
+static int find_client_ip_slot ( clientmgr_ctx *ctx, struct client *client, const struct in6_addr *address )
+{
+	struct client_ip_ref *ref = find_client_ip_ref ( ctx, client, address );
+
+	if ( ref && ref->slot < VECTOR_LEN ( client->addresses ) &&
+	     memcmp ( address, &VECTOR_INDEX ( client->addresses, ref->slot ).addr, sizeof ( struct in6_addr ) ) == 0 )
+		return ref->slot;
+
+	// inactive addresses that were taken over by another client and clients in the old-queue are not indexed
+	for ( int i = VECTOR_LEN ( client->addresses )-1; i>=0; i-- ) {
+		if ( memcmp ( address, &VECTOR_INDEX ( client->addresses, i ).addr, sizeof ( struct in6_addr ) ) == 0 )
+			return i;
+	}
+
+	return -1;
+}
+
 /** Given an IP address returns the client-object of a client.
   Returns NULL if no object is found.
   */
 struct client_ip *get_client_ip ( struct client *client, const struct in6_addr *address )
 {
-	for ( int i = VECTOR_LEN ( client->addresses )-1; i>=0; i-- ) {
-		struct client_ip *e = &VECTOR_INDEX ( client->addresses, i );
+	int i = find_client_ip_slot ( &l3ctx.clientmgr_ctx, client, address );
+
+	return i < 0 ? NULL : &VECTOR_INDEX ( client->addresses, i );
+}
 
-		if ( memcmp ( address, &e->addr, sizeof ( struct in6_addr ) ) == 0 )
-			return e;
+/** Point the address index at another local client that holds an address, preferring one that uses it.
+  The index holds a single client per address, this is called once that client gave it up.
+  */
+static void reindex_client_ip ( clientmgr_ctx *ctx, const struct in6_addr *address )
+{
+	struct client *owner = NULL;
+	struct client_ip *owner_ip = NULL;
+
+	for ( uint32_t i = 0; i < SLAB_CAPACITY ( ctx->clients ); i++ ) {
+		struct client *c = slab_get ( &ctx->clients, i );
+		struct client_ip *ip = c ? get_client_ip ( c, address ) : NULL;
+
+		if ( ip && ( !owner || ( owner_ip->state == IP_INACTIVE && ip->state != IP_INACTIVE ) ) ) {
+			owner = c;
+			owner_ip = ip;
+		}
 	}
 
-	return NULL;
+	if ( owner )
+		index_client_ip ( ctx, owner, owner_ip );
 }
 
 /** Removes an IP address from a client. Safe to call if the IP is not
@@ -230,18 +299,38 @@ struct client_ip *get_client_ip ( struct client *client, const struct in6_addr *
   */
 void delete_client_ip ( struct client *client, const struct in6_addr *address, bool cleanup )
 {
-	for ( int i = VECTOR_LEN ( client->addresses )-1; i>=0; i-- ) {
+	clientmgr_ctx *ctx = &l3ctx.clientmgr_ctx;
+	struct in6_addr addr = *address; // address may point into the address list that is modified below
+	int i = find_client_ip_slot ( ctx, client, &addr );
+
+	if ( i >= 0 ) {
 		struct client_ip *e = &VECTOR_INDEX ( client->addresses, i );
 
-		if ( memcmp ( address, &e->addr, sizeof ( struct in6_addr ) ) == 0 ) {
-			client_ip_set_state ( &l3ctx.clientmgr_ctx, client, get_client_ip ( client,address ), IP_INACTIVE );
-			if ( cleanup )
-				VECTOR_DELETE ( client->addresses, i );
+		client_ip_set_state ( ctx, client, e, IP_INACTIVE );
+		if ( cleanup ) {
+			bool indexed = find_client_ip_ref ( ctx, client, &addr );
+
+			// move the last address into the gap instead of shifting all following addresses
+			int last = VECTOR_LEN ( client->addresses ) - 1;
+			if ( i != last ) {
+				*e = VECTOR_INDEX ( client->addresses, last );
+
+				struct client_ip_ref *ref = find_client_ip_ref ( ctx, client, &e->addr );
+				if ( ref )
+					ref->slot = i;
+			}
+			VECTOR_DELETE ( client->addresses, last );
+
+			// another client may still hold the address
+			if ( indexed ) {
+				hashmap_remove ( &ctx->address_index, &addr );
+				reindex_client_ip ( ctx, &addr );
+			}
 		}
 	}
 
 	char str[INET6_ADDRSTRLEN+1];
-	inet_ntop ( AF_INET6, address, str, INET6_ADDRSTRLEN );
+	inet_ntop ( AF_INET6, &addr, str, INET6_ADDRSTRLEN );
 	printf ( "\x1b[31mDeleted IP %s from client %zi addresses are still assigned\x1b[0m ", str, VECTOR_LEN ( client->addresses ) );
 	print_client ( client );
 
@@ -268,6 +357,9 @@ static void client_add_route ( clientmgr_ctx *ctx, struct client *client, struct
 		routemgr_insert_neighbor ( &l3ctx.routemgr_ctx, client->ifindex, &ip->addr, client->mac );
 		routemgr_insert_route ( CTX ( routemgr ), ctx->export_table, client->ifindex, &ip->addr, 128 );
 	}
+
+	// nodes that sought this address do not have to wait for the routing protocol to learn where it is
+	intercom_address_found ( CTX ( intercom ), &ip->addr );
 }
 
 /** Remove a route.
@@ -289,48 +381,59 @@ static void client_remove_route ( clientmgr_ctx *ctx, struct client *client, str
 /** Given a MAC address returns a client object.
   Returns NULL if the client is not known.
   */
-struct client *findinvector ( void *_vector, const uint8_t mac[ETH_ALEN] )
+struct client *findinslab ( slab_t *slab, hashmap_t *index, const uint8_t mac[ETH_ALEN] )
 {
-	VECTOR ( struct client ) *vector = _vector;
-	for ( int _vector_index = VECTOR_LEN ( *vector ) -1 ; _vector_index>=0; _vector_index-- ) {
-		struct client *e = &VECTOR_INDEX ( *vector, _vector_index );
+	uint64_t key = mac2key ( mac );
+	uint32_t *i = hashmap_get ( index, &key );
 
-		if ( memcmp ( mac, e->mac, sizeof ( uint8_t ) * 6 ) == 0 )
-			return e;
-	}
+	if ( i == NULL )
+		return NULL;
+
+	return slab_get ( slab, *i );
+}
+
+/** Removes a client from its slab and index. The client must not be used afterwards.
+  */
+static void remove_from_slab ( slab_t *slab, hashmap_t *index, struct client *client )
+{
+	uint64_t key = mac2key ( client->mac );
 
-	return NULL;
+	hashmap_remove ( index, &key );
+	slab_free ( slab, client->handle.index );
 }
 
 struct client *get_client ( const uint8_t mac[ETH_ALEN] )
 {
-	return findinvector ( &l3ctx.clientmgr_ctx.clients, mac );
+	return findinslab ( &l3ctx.clientmgr_ctx.clients, &l3ctx.clientmgr_ctx.client_index, mac );
+}
+
+/** Given a handle returns the client it refers to.
+  Returns NULL if the client was deleted since the handle was obtained.
+  */
+struct client *clientmgr_resolve ( clientmgr_ctx *ctx, client_handle_t handle )
+{
+	return slab_resolve ( &ctx->clients, handle );
 }
 
 struct client *get_client_old ( const uint8_t mac[ETH_ALEN] )
 {
-	return findinvector ( &l3ctx.clientmgr_ctx.oldclients, mac );
+	return findinslab ( &l3ctx.clientmgr_ctx.oldclients, &l3ctx.clientmgr_ctx.oldclient_index, mac );
 }
 
 /** Given an ip-address, this returns true if there is a local client connected having this IP-address and false otherwise
 */
 bool clientmgr_is_known_address ( clientmgr_ctx *ctx, const struct in6_addr *address, struct client **client )
 {
-	// TODO: we probably should make this more efficient for large lists of clients and IP addresses at one point.
-	for ( int i = VECTOR_LEN ( ctx->clients ) - 1; i>=0; i-- ) {
-		struct client *c = &VECTOR_INDEX ( ctx->clients, i );
+	struct client_ip_ref *ref = hashmap_get ( &ctx->address_index, address );
+	struct client *c = ref ? clientmgr_resolve ( ctx, ref->client ) : NULL;
 
-		for ( int j = VECTOR_LEN ( c->addresses )-1; j>=0; j-- ) {
-			struct client_ip *a = &VECTOR_INDEX ( c->addresses, j );
-			if ( !memcmp ( address, &a->addr, sizeof ( struct in6_addr ) ) ) {
-				log_debug ( "%s is attached to local client %s\n", print_ip ( address ), print_mac(c->mac) );
+	if ( c ) {
+		log_debug ( "%s is attached to local client %s\n", print_ip ( address ), print_mac(c->mac) );
 
-				if ( client ) {
-					*client = c;
-				}
-				return true;
-			}
+		if ( client ) {
+			*client = c;
 		}
+		return true;
 	}
 
 	log_debug ( "%s is not assigned to any of the local clients\n", print_ip ( address ) );
@@ -338,17 +441,21 @@ bool clientmgr_is_known_address ( clientmgr_ctx *ctx, const struct in6_addr *add
 	return false;
 }
 
-struct client *create_client ( client_vector *vector, const uint8_t mac[ETH_ALEN],const unsigned int ifindex )
+struct client *create_client ( slab_t *slab, hashmap_t *index, const uint8_t mac[ETH_ALEN],const unsigned int ifindex )
 {
-	struct client _client = {};
-	memcpy ( _client.mac, mac, sizeof ( uint8_t ) * 6 );
-	_client.ifindex = ifindex;
-	_client.node_ip_initialized = false;
-	_client.platprefix = l3ctx.clientmgr_ctx.platprefix;
-	_client.claimed = false;
-	VECTOR_INIT( _client.addresses );
-	VECTOR_ADD ( *vector, _client );
-	struct client *client = &VECTOR_INDEX ( *vector, VECTOR_LEN ( *vector ) - 1 );
+	client_handle_t handle;
+	struct client *client = slab_alloc ( slab, &handle );
+
+	client->handle = handle;
+	memcpy ( client->mac, mac, sizeof ( uint8_t ) * 6 );
+	client->ifindex = ifindex;
+	client->node_ip_initialized = false;
+	client->platprefix = l3ctx.clientmgr_ctx.platprefix;
+	client->claimed = false;
+	VECTOR_INIT( client->addresses );
+
+	uint64_t key = mac2key ( mac );
+	hashmap_put ( index, &key, &handle.index );
 
 	return client;
 }
@@ -360,7 +467,7 @@ struct client *get_or_create_client ( const uint8_t mac[ETH_ALEN], unsigned int
 	struct client *client = get_client ( mac );
 
 	if ( client == NULL ) {
-		client = create_client ( &l3ctx.clientmgr_ctx.clients, mac, ifindex );
+		client = create_client ( &l3ctx.clientmgr_ctx.clients, &l3ctx.clientmgr_ctx.client_index, mac, ifindex );
 	}
 
 	return client;
@@ -372,9 +479,10 @@ void clientmgr_purge_clients ( clientmgr_ctx *ctx )
 {
 	struct client *client;
 
-	for ( int i=VECTOR_LEN ( ctx->clients )-1; i>=0; i-- ) {
-		client=&VECTOR_INDEX ( ctx->clients, i );
-		clientmgr_delete_client ( ctx, client->mac );
+	for ( uint32_t i = 0; i < SLAB_CAPACITY ( ctx->clients ); i++ ) {
+		client = slab_get ( &ctx->clients, i );
+		if ( client )
+			clientmgr_delete_client ( ctx, client->mac );
 	}
 }
 
@@ -386,7 +494,14 @@ void client_copy_to_old ( struct client *client )
 	then.tv_sec = now.tv_sec + OLDCLIENTS_KEEP_SECONDS;
 	then.tv_nsec = now.tv_nsec;
 
-	struct client *_client = create_client ( &l3ctx.clientmgr_ctx.oldclients,  client->mac, client->ifindex );
+	// only keep the most recent copy of a client
+	struct client *old = get_client_old ( client->mac );
+	if ( old ) {
+		VECTOR_FREE ( old->addresses );
+		remove_from_slab ( &l3ctx.clientmgr_ctx.oldclients, &l3ctx.clientmgr_ctx.oldclient_index, old );
+	}
+
+	struct client *_client = create_client ( &l3ctx.clientmgr_ctx.oldclients, &l3ctx.clientmgr_ctx.oldclient_index, client->mac, client->ifindex );
 	_client->timeout = then;
 	_client->platprefix = client->platprefix;
 
@@ -401,22 +516,6 @@ void client_copy_to_old ( struct client *client )
 }
 
 
-/** This will set all IP addresses of the client to IP_INACTIVE and remove the special IP & route
-*/
-void client_deactivate ( struct client *client )
-{
-	struct client *_client = get_client ( client->mac );
-	client_copy_to_old ( _client );
-	for ( int i=VECTOR_LEN ( _client->addresses ) - 1; i>=0; i-- ) {
-		struct client_ip *ip = &VECTOR_INDEX ( _client->addresses, i );
-		if ( ip )
-			client_ip_set_state ( &l3ctx.clientmgr_ctx, _client, ip, IP_INACTIVE );
-	}
-	VECTOR_FREE ( _client->addresses );
-	remove_special_ip ( &l3ctx.clientmgr_ctx, _client );
-}
-
-
 /** Given a MAC address deletes a client. Safe to call if the client is not
   known.
   */
@@ -445,12 +544,7 @@ void clientmgr_delete_client ( clientmgr_ctx *ctx, uint8_t mac[ETH_ALEN] )
 	}
 	VECTOR_FREE ( client->addresses );
 
-	for ( int i=VECTOR_LEN ( ctx->clients )-1; i>=0; i-- ) {
-		if ( memcmp ( & ( VECTOR_INDEX ( ctx->clients, i ).mac ), mac, sizeof ( uint8_t ) *6 ) == 0 ) {
-			VECTOR_DELETE ( ctx->clients, i );
-			break;
-		}
-	}
+	remove_from_slab ( &ctx->clients, &ctx->client_index, client );
 }
 
 const char *state_str ( enum ip_state state )
@@ -531,6 +625,12 @@ void client_ip_set_state ( clientmgr_ctx *ctx, struct client *client, struct cli
 		log_error ( "%s changes from %s to %s\n", print_ip ( &ip->addr ), state_str ( ip->state ), state_str ( state ) );
 
 	ip->state = state;
+
+	// an address in use belongs to this client. Inactive addresses do not take over an address from another client.
+	if ( state != IP_INACTIVE || !hashmap_get ( &ctx->address_index, &ip->addr ) )
+		index_client_ip ( ctx, client, ip );
+	else if ( !nop && find_client_ip_ref ( ctx, client, &ip->addr ) )
+		reindex_client_ip ( ctx, &ip->addr );
 }
 
 /** Check whether an IP address is contained in a client prefix.
@@ -654,17 +754,17 @@ void purge_oldclientlist_from_old_clients()
 
 	log_debug ( "Purging old clients\n" );
 
-	for ( int i = VECTOR_LEN ( l3ctx.clientmgr_ctx.oldclients )-1; i>=0; i-- ) {
-		_client = &VECTOR_INDEX ( l3ctx.clientmgr_ctx.oldclients, i );
+	for ( uint32_t i = 0; i < SLAB_CAPACITY ( l3ctx.clientmgr_ctx.oldclients ); i++ ) {
+		_client = slab_get ( &l3ctx.clientmgr_ctx.oldclients, i );
 
-		if ( timespec_cmp ( _client->timeout, now ) <= 0 ) {
+		if ( _client && timespec_cmp ( _client->timeout, now ) <= 0 ) {
 			if ( l3ctx.debug ) {
 				printf ( "removing client from old-queue\n" );
 				print_client ( _client );
 			}
 
 			free_client_addresses ( _client );
-			VECTOR_DELETE ( l3ctx.clientmgr_ctx.oldclients, i );
+			remove_from_slab ( &l3ctx.clientmgr_ctx.oldclients, &l3ctx.clientmgr_ctx.oldclient_index, _client );
 		}
 	}
 }
@@ -744,7 +844,11 @@ bool clientmgr_handle_info ( clientmgr_ctx *ctx, struct client *foreign_client )
 
 void clientmgr_init()
 {
-	VECTOR_INIT( (&l3ctx.clientmgr_ctx)->clients );
+	slab_init ( &l3ctx.clientmgr_ctx.clients, sizeof ( struct client ) );
+	slab_init ( &l3ctx.clientmgr_ctx.oldclients, sizeof ( struct client ) );
+	hashmap_init ( &l3ctx.clientmgr_ctx.client_index, sizeof ( uint64_t ), sizeof ( uint32_t ), hashmap_hash_u64 );
+	hashmap_init ( &l3ctx.clientmgr_ctx.oldclient_index, sizeof ( uint64_t ), sizeof ( uint32_t ), hashmap_hash_u64 );
+	hashmap_init ( &l3ctx.clientmgr_ctx.address_index, sizeof ( struct in6_addr ), sizeof ( struct client_ip_ref ), NULL );
 	post_task ( &l3ctx.taskqueue_ctx, OLDCLIENTS_KEEP_SECONDS, 0, purge_oldclients_task, NULL, NULL );
 }
 
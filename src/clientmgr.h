@@ -1,10 +1,13 @@
 #pragma once
 
 #include "vector.h"
+#include "hashmap.h"
+#include "slab.h"
 #include "prefix.h"
 #include "common.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <netinet/in.h>
 #include <time.h>
 
@@ -16,7 +19,7 @@ enum ip_state {
 	IP_TENTATIVE // address was received info on intercom OR belongs to a re-activated local client
 };
 
-typedef VECTOR(struct client) client_vector;
+typedef slab_handle_t client_handle_t;
 
 struct client_ip {
 	struct in6_addr addr;
@@ -26,6 +29,7 @@ struct client_ip {
 };
 
 typedef struct client {
+	client_handle_t handle;
 	struct in6_addr platprefix;
 	struct timespec timeout;
 	VECTOR(struct client_ip) addresses;
@@ -42,8 +46,11 @@ typedef struct {
 	struct prefix v4prefix;
 	struct in6_addr platprefix;
 	VECTOR(struct prefix) prefixes;
-	client_vector clients;
-	client_vector oldclients;
+	slab_t clients;
+	slab_t oldclients;
+	hashmap_t client_index; // MAC -> slot in clients
+	hashmap_t oldclient_index; // MAC -> slot in oldclients
+	hashmap_t address_index; // IP address -> client and position in its address list
 	unsigned int export_table;
 	int nat46ifindex;
 	bool platprefix_set;
@@ -64,7 +71,17 @@ bool clientmgr_handle_info(clientmgr_ctx *ctx, struct client *foreign_client);
 void clientmgr_purge_clients(clientmgr_ctx *ctx);
 void clientmgr_delete_client(clientmgr_ctx *ctx, uint8_t mac[ETH_ALEN]);
 void client_ip_set_state(clientmgr_ctx *ctx, struct client *client, struct client_ip *ip, enum ip_state state);
+/** Packs a MAC address into an integer to be used as hash map key */
+static inline uint64_t mac2key(const uint8_t mac[ETH_ALEN]) {
+	uint64_t key = 0;
+	memcpy(&key, mac, ETH_ALEN);
+	return key;
+}
+
 struct client *get_client(const uint8_t mac[ETH_ALEN]);
+struct client *get_or_create_client(const uint8_t mac[ETH_ALEN], unsigned int ifindex);
+void delete_client_ip(struct client *client, const struct in6_addr *address, bool cleanup);
+struct client *clientmgr_resolve(clientmgr_ctx *ctx, client_handle_t handle);
 bool clientmgr_is_known_address(clientmgr_ctx *ctx, const struct in6_addr *address, struct client **client);
 void add_special_ip(clientmgr_ctx *ctx, struct client *client);
 struct client_ip *get_client_ip(struct client *client, const struct in6_addr *address);
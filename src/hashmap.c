@@ -0,0 +1,194 @@
+/**
+   \file
+
+   Hash maps with fixed-size keys and values, using open addressing
+
+   Collisions are resolved by linear probing. Entries are removed by shifting
+   the following entries of the probe sequence back, so no tombstones are
+   needed and lookups stay short even after many removals.
+*/
+
+
+#include "hashmap.h"
+#include "alloc.h"
+
+#include <string.h>
+
+
+/** The minimum number of buckets to allocate */
+#define MIN_HASHMAP_ALLOC 16
+
+/** Round up to a multiple of 8 bytes to keep values properly aligned */
+#define HASHMAP_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+
+static inline size_t stride(const hashmap_t *map) {
+	return HASHMAP_ALIGN(map->keysize) + HASHMAP_ALIGN(map->valuesize);
+}
+
+static inline size_t home(const hashmap_t *map, const void *key) {
+	return map->hash(key, map->keysize) & (map->allocated - 1);
+}
+
+/** FNV-1a over the key bytes. This is the default hash function. */
+uint32_t hashmap_hash_bytes(const void *key, size_t keysize) {
+	const uint8_t *p = key;
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < keysize; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/** Fibonacci hashing for keys that are a single uint64_t, e.g. a MAC address packed into 48 bits */
+uint32_t hashmap_hash_u64(const void *key, size_t keysize) {
+	uint64_t k;
+	memcpy(&k, key, sizeof(k));
+	return (k * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+void *hashmap_bucket_key(const hashmap_t *map, size_t bucket) {
+	return map->data + bucket * stride(map);
+}
+
+void *hashmap_bucket_value(const hashmap_t *map, size_t bucket) {
+	return map->data + bucket * stride(map) + HASHMAP_ALIGN(map->keysize);
+}
+
+/** Initializes an empty map. \e hash may be NULL to use hashmap_hash_bytes(). */
+void hashmap_init(hashmap_t *map, size_t keysize, size_t valuesize, uint32_t (*hash)(const void *key, size_t keysize)) {
+	map->allocated = 0;
+	map->length = 0;
+	map->keysize = keysize;
+	map->valuesize = valuesize;
+	map->hash = hash ? hash : hashmap_hash_bytes;
+	map->used = NULL;
+	map->data = NULL;
+}
+
+/** Frees all resources used by the map. The map is empty but usable afterwards. */
+void hashmap_free(hashmap_t *map) {
+	free(map->used);
+	free(map->data);
+	map->used = NULL;
+	map->data = NULL;
+	map->allocated = 0;
+	map->length = 0;
+}
+
+/** Finds the bucket holding \e key or the empty bucket where it would be inserted */
+static size_t find_bucket(const hashmap_t *map, const void *key, bool *found) {
+	size_t mask = map->allocated - 1;
+	size_t i = home(map, key);
+
+	while (map->used[i]) {
+		if (!memcmp(hashmap_bucket_key(map, i), key, map->keysize)) {
+			*found = true;
+			return i;
+		}
+		i = (i + 1) & mask;
+	}
+
+	*found = false;
+	return i;
+}
+
+/** Reallocates the map to \e n buckets and re-inserts all entries */
+static void rehash(hashmap_t *map, size_t n) {
+	hashmap_t old = *map;
+
+	map->allocated = n;
+	map->used = l3roamd_alloc0(n);
+	map->data = l3roamd_alloc(n * stride(map));
+
+	for (size_t i = 0; i < old.allocated; i++) {
+		if (!old.used[i])
+			continue;
+
+		bool found;
+		size_t b = find_bucket(map, hashmap_bucket_key(&old, i), &found);
+		memcpy(hashmap_bucket_key(map, b), hashmap_bucket_key(&old, i), stride(map));
+		map->used[b] = 1;
+	}
+
+	free(old.used);
+	free(old.data);
+}
+
+/**
+   Returns a pointer to the value stored for \e key or NULL if the key is unknown
+
+   The pointer is valid until the next insertion into or removal from the map.
+*/
+void *hashmap_get(const hashmap_t *map, const void *key) {
+	if (!map->length)
+		return NULL;
+
+	bool found;
+	size_t i = find_bucket(map, key, &found);
+
+	return found ? hashmap_bucket_value(map, i) : NULL;
+}
+
+/**
+   Inserts \e key with \e value or replaces the value of an existing entry
+
+   \e value may be NULL to leave the value of a new entry zeroed or an
+   existing value untouched. Returns a pointer to the stored value that is
+   valid until the next insertion into or removal from the map.
+*/
+void *hashmap_put(hashmap_t *map, const void *key, const void *value) {
+	// keep the load factor below 70% so probe sequences stay short
+	if ((map->length + 1) * 10 > map->allocated * 7)
+		rehash(map, map->allocated ? map->allocated << 1 : MIN_HASHMAP_ALLOC);
+
+	bool found;
+	size_t i = find_bucket(map, key, &found);
+	void *v = hashmap_bucket_value(map, i);
+
+	if (!found) {
+		memcpy(hashmap_bucket_key(map, i), key, map->keysize);
+		memset(v, 0, map->valuesize);
+		map->used[i] = 1;
+		map->length++;
+	}
+
+	if (value)
+		memcpy(v, value, map->valuesize);
+
+	return v;
+}
+
+/** Removes \e key from the map. Returns false if the key was not present. */
+bool hashmap_remove(hashmap_t *map, const void *key) {
+	if (!map->length)
+		return false;
+
+	bool found;
+	size_t i = find_bucket(map, key, &found);
+	if (!found)
+		return false;
+
+	size_t mask = map->allocated - 1;
+	size_t j = i;
+
+	// move back every entry of the probe sequence whose home bucket does not lie between the hole and its position
+	while (true) {
+		j = (j + 1) & mask;
+		if (!map->used[j])
+			break;
+
+		size_t k = home(map, hashmap_bucket_key(map, j));
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+			memcpy(hashmap_bucket_key(map, i), hashmap_bucket_key(map, j), stride(map));
+			i = j;
+		}
+	}
+
+	map->used[i] = 0;
+	map->length--;
+	return true;
+}
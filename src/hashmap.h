@@ -0,0 +1,60 @@
+/**
+   \file
+
+   Hash maps with fixed-size keys and values, using open addressing
+*/
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** A hash map descriptor */
+typedef struct hashmap {
+	size_t allocated;		/**< The number of buckets, always a power of 2 (or 0) */
+	size_t length;			/**< The number of entries in the map */
+	size_t keysize;			/**< The size of a key in bytes */
+	size_t valuesize;		/**< The size of a value in bytes */
+	uint32_t (*hash)(const void *key, size_t keysize);	/**< The hash function for keys */
+	uint8_t *used;			/**< Marks which buckets are occupied */
+	uint8_t *data;			/**< Storage for keys and values */
+} hashmap_t;
+
+
+uint32_t hashmap_hash_bytes(const void *key, size_t keysize);
+uint32_t hashmap_hash_u64(const void *key, size_t keysize);
+
+void hashmap_init(hashmap_t *map, size_t keysize, size_t valuesize, uint32_t (*hash)(const void *key, size_t keysize));
+void hashmap_free(hashmap_t *map);
+void *hashmap_get(const hashmap_t *map, const void *key);
+void *hashmap_put(hashmap_t *map, const void *key, const void *value);
+bool hashmap_remove(hashmap_t *map, const void *key);
+
+void *hashmap_bucket_key(const hashmap_t *map, size_t bucket);
+void *hashmap_bucket_value(const hashmap_t *map, size_t bucket);
+
+
+/**
+   Returns the number of entries in the map \e m
+
+   \hideinitializer
+*/
+#define HASHMAP_LEN(m) ((m).length)
+
+/**
+   Returns the number of buckets of the map \e m. Use this together with
+   HASHMAP_BUCKET_USED() to iterate over all entries.
+
+   \hideinitializer
+*/
+#define HASHMAP_BUCKETS(m) ((m).allocated)
+
+/**
+   Checks whether the bucket \e i of the map \e m holds an entry
+
+   \hideinitializer
+*/
+#define HASHMAP_BUCKET_USED(m, i) ((m).used[i])
@@ -220,8 +220,10 @@ void icmp6_handle_ns_in(icmp6_ctx *ctx, int fd) {
 			if (memcmp(&packet.hdr.ip6_src, "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16) == 0) {
 				// client is doing DAD. We could trigger sending NS on this IP address for a couple of times in a while to learn its address instead of flooding the network. If we do this, what effects will this have on privacy extensions?
 				log_verbose("triggering local NS cycle after DAD for address %s\n",print_ip(&packet.sol.hdr.nd_ns_target));
+				// repeated DAD probes for the same address join the cycle that is already running
+				taskqueue_key_t key = taskqueue_key(TASK_KEY_DAD, &packet.sol.hdr.nd_ns_target, sizeof(struct in6_addr));
 				struct ns_task *ns_data = create_ns_task ( &packet.sol.hdr.nd_ns_target, (struct timespec){.tv_sec=0, .tv_nsec=300000000,}, 15, true);
-				post_task ( CTX ( taskqueue ), 0, 0, ipmgr_ns_task, free, ns_data );
+				post_keyed_task ( CTX ( taskqueue ), &key, TASK_MERGE, 0, 0, ipmgr_ns_task, free_ns_task, ns_data );
 			}
 			else {
 				log_debug("Received Neighbor Solicitation from %s [%s] for IP %s. Learning source-IP for client.\n", print_ip(&packet.hdr.ip6_src), print_mac(mac), print_ip(&packet.sol.hdr.nd_ns_target));
@@ -278,7 +280,8 @@ void icmp6_handle_in(icmp6_ctx *ctx, int fd) {
 
 		log_debug("Learning from Neighbour Advertisement that Client [%02x:%02x:%02x:%02x:%02x:%02x] is active on ip %s\n",  packet.hw_addr[0], packet.hw_addr[1], packet.hw_addr[2], packet.hw_addr[3], packet.hw_addr[4], packet.hw_addr[5], print_ip(&packet.hdr.nd_na_target));
 
-		// TODO: make sure to stop possibly previously started NS-cycles due to DAD,
+		// the address answered, so running NS cycles for it are pointless
+		ipmgr_cancel_ns(CTX(ipmgr), &packet.hdr.nd_na_target);
 
 		clientmgr_add_address(CTX(clientmgr), &packet.hdr.nd_na_target, packet.hw_addr, ctx->ifindex);
 	}
@@ -3,15 +3,16 @@
 #include "l3roamd.h"
 #include "if.h"
 #include "icmp6.h"
-#include "syscallwrappers.h"
 #include "prefix.h"
 #include "util.h"
 #include "alloc.h"
+#include "random.h"
 
 #include "clientmgr.h"
 
 #include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -21,9 +22,16 @@
 #include <string.h>
 
 #define INTERCOM_GROUP "ff02::5523"
-#define INTERCOM_MAX_RECENT 100
 
-void schedule_retries(struct intercom_task *data, int ms_timeout, void (*processor)(void *data)  );
+/** The control message space for the ingress interface of a datagram */
+#define RECV_CMSG_SPACE CMSG_SPACE(sizeof(struct in6_pktinfo))
+
+void schedule_retries(struct intercom_task *data);
+static void block_sendq(intercom_ctx *ctx);
+static bool destination_held(intercom_ctx *ctx, const struct intercom_destination *dest);
+static void hold_destination(intercom_ctx *ctx, const struct intercom_destination *dest);
+static void compact_sendq(intercom_ctx *ctx);
+static bool queue_unicast(intercom_ctx *ctx, const struct in6_addr *recipient, const uint8_t *packet, size_t packet_len);
 
 bool join_mcast(const int sock, const struct in6_addr addr, intercom_if_t *iface) {
 	struct ipv6_mreq mreq;
@@ -45,12 +53,21 @@ error:
 	return false;
 }
 
+void leave_mcast(const int sock, const struct in6_addr addr, intercom_if_t *iface) {
+	struct ipv6_mreq mreq = {
+		.ipv6mr_multiaddr = addr,
+		.ipv6mr_interface = iface->ifindex,
+	};
+
+	if (mreq.ipv6mr_interface && setsockopt(sock, IPPROTO_IPV6, IPV6_LEAVE_GROUP, &mreq, sizeof(mreq)) < 0 && errno != EADDRNOTAVAIL && errno != ENODEV)
+		log_error("Could not leave multicast group on %s: %s\n", iface->ifname, strerror(errno));
+}
+
 void free_intercom_task(void *d) {
 	struct intercom_task *data = d;
-	free(data->packet);
-	free(data->client);
-	free(data->recipient);
-	free(data);
+	l3roamd_pool_free(&l3ctx.intercom_ctx.packet_pool, data->packet);
+	l3roamd_pool_free(&l3ctx.intercom_ctx.address_pool, data->recipient);
+	l3roamd_pool_free(&l3ctx.intercom_ctx.task_pool, data);
 }
 
 void intercom_update_interfaces(intercom_ctx *ctx) {
@@ -62,7 +79,7 @@ void intercom_update_interfaces(intercom_ctx *ctx) {
 		if (!iface->ifindex)
 			continue;
 
-		iface->ok = join_mcast(VECTOR_INDEX(ctx->interfaces, i).mcast_recv_fd, ctx->groupaddr.sin6_addr, iface);
+		iface->ok = join_mcast(ctx->mcast_recv_fd, ctx->groupaddr.sin6_addr, iface);
 	}
 }
 
@@ -113,19 +130,6 @@ bool intercom_add_interface(intercom_ctx *ctx, char *ifname)
 		.ifindex = ifindex
 	};
 
-	int fd = socket(PF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
-	if (fd < 0)
-		exit_error("creating socket");
-
-	ctx->groupaddr.sin6_scope_id = ifindex;
-	if (bind(fd, (struct sockaddr *)&ctx->groupaddr, sizeof(ctx->groupaddr)) < 0) {
-		perror("bind to multicast-address failed");
-		exit(EXIT_FAILURE);
-	}
-
-	iface.mcast_recv_fd = fd;
-	log_debug("ASSIGNING fd: %i to mcast_recv_fd on interface %s\n", fd, ifname);
-
 	VECTOR_ADD(ctx->interfaces, iface);
 	intercom_update_interfaces(&l3ctx.intercom_ctx);
 
@@ -141,7 +145,7 @@ bool intercom_del_interface(intercom_ctx *ctx, char *ifname)
 	if (! meshif)
 		return false;
 
-	close(meshif->mcast_recv_fd);
+	leave_mcast(ctx->mcast_recv_fd, ctx->groupaddr.sin6_addr, meshif);
 
 	free(meshif->ifname);
 
@@ -177,6 +181,18 @@ end:
 	freeifaddrs(ifap);
 }
 
+/** Fills in the header templates used by assemble_header(). Must be called again when the node IP changes. */
+static void init_templates(intercom_ctx *ctx) {
+	for (int type = 0; type < INTERCOM_TYPES; type++) {
+		intercom_packet_hdr *hdr = &ctx->templates[type];
+
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->version = L3ROAMD_PACKET_FORMAT_VERSION;
+		hdr->type = type;
+		memcpy(&hdr->sender, &ctx->ip, 16);
+	}
+}
+
 void intercom_init_unicast(intercom_ctx *ctx)
 {
 	struct sockaddr_in6 server_addr = {
@@ -188,6 +204,11 @@ void intercom_init_unicast(intercom_ctx *ctx)
 	if (ctx->unicast_nodeip_fd < 0)
 		exit_error("creating socket for intercom on node-IP");
 
+	// the multicast socket is bound to the same port on all addresses
+	int one = 1;
+	if (setsockopt(ctx->unicast_nodeip_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+		exit_error("setsockopt: SO_REUSEADDR");
+
 	memcpy(&server_addr.sin6_addr, ctx->ip.s6_addr, 16);
 	if (bind(ctx->unicast_nodeip_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
 		perror("bind socket to node-IP failed");
@@ -195,6 +216,42 @@ void intercom_init_unicast(intercom_ctx *ctx)
 	}
 
 	log_verbose("ASSIGNING fd: %i to unicast_nodeip_fd\n", ctx->unicast_nodeip_fd);
+
+	init_templates(ctx);
+}
+
+/**
+   Creates the socket receiving the multicast packets of all mesh interfaces
+
+   It is bound to the intercom port on all addresses and joins the group on
+   every mesh interface. Unicast packets still go to the more specific sockets
+   of the node IP and the node-client IPs. The ingress interface of every
+   datagram is passed along so packets from other interfaces can be dropped.
+*/
+static void init_multicast(intercom_ctx *ctx) {
+	struct sockaddr_in6 addr = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = in6addr_any,
+		.sin6_port = htons(INTERCOM_PORT),
+	};
+	int one = 1;
+
+	ctx->mcast_recv_fd = socket(PF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (ctx->mcast_recv_fd < 0)
+		exit_error("creating socket for intercom multicast");
+
+	if (setsockopt(ctx->mcast_recv_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+		exit_error("setsockopt: SO_REUSEADDR");
+
+	if (setsockopt(ctx->mcast_recv_fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &one, sizeof(one)) < 0)
+		exit_error("setsockopt: IPV6_RECVPKTINFO");
+
+	if (bind(ctx->mcast_recv_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind to multicast-address failed");
+		exit(EXIT_FAILURE);
+	}
+
+	log_verbose("ASSIGNING fd: %i to mcast_recv_fd\n", ctx->mcast_recv_fd);
 }
 
 void intercom_init(intercom_ctx *ctx)
@@ -210,18 +267,47 @@ void intercom_init(intercom_ctx *ctx)
 		.sin6_port = htons(INTERCOM_PORT),
 	};
 
+	ctx->recv_batch = INTERCOM_DEFAULT_RECV_BATCH;
+	ctx->recv_msgs = NULL;
+	ctx->recv_iovs = NULL;
+	ctx->recv_bufs = NULL;
+	ctx->recv_cmsgs = NULL;
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	VECTOR_INIT(ctx->sendq);
+	VECTOR_INIT(ctx->sendq_buf);
+	ctx->sendq_reserved = 0;
+	ctx->sendq_blocked = false;
+	VECTOR_INIT(ctx->sendq_held);
+	VECTOR_INIT(ctx->seek_pending);
+	VECTOR_INIT(ctx->ack_pending);
+
+	ctx->recent = NULL;
+	ctx->recent_max = INTERCOM_DEFAULT_RECENT;
+	ctx->recent_next = ctx->recent_len = 0;
+	hashmap_init(&ctx->recent_index, sizeof(struct intercom_packet_id), sizeof(uint32_t), NULL);
+	ctx->relay_threshold = 0;
+	hashmap_init(&ctx->relays, sizeof(struct intercom_packet_id), sizeof(uint32_t), NULL);
+	hashmap_init(&ctx->claims, sizeof(uint64_t), sizeof(struct intercom_exchange), hashmap_hash_u64);
+	hashmap_init(&ctx->claim_batches, sizeof(struct in6_addr), sizeof(struct intercom_claim_batch *), NULL);
+	hashmap_init(&ctx->infos, sizeof(uint64_t), sizeof(struct intercom_exchange), hashmap_hash_u64);
+	hashmap_init(&ctx->seekers, sizeof(struct in6_addr), sizeof(struct intercom_seekers), NULL);
+	hashmap_init(&ctx->peers, sizeof(struct in6_addr), sizeof(struct intercom_peer), NULL);
+	memset(&ctx->mesh, 0, sizeof(ctx->mesh));
+
+	l3roamd_pool_init(&ctx->task_pool, "intercom_tasks", sizeof(struct intercom_task), 32);
+	l3roamd_pool_init(&ctx->packet_pool, "intercom_packets", INTERCOM_PACKET_MAX, 32);
+	l3roamd_pool_init(&ctx->batch_pool, "intercom_claim_batches", sizeof(struct intercom_claim_batch), 8);
+	l3roamd_pool_init(&ctx->address_pool, "intercom_recipients", sizeof(struct in6_addr), 32);
+
+	init_templates(ctx);
+	init_multicast(ctx);
 	intercom_update_interfaces(ctx);
 }
 
 int assemble_header(intercom_packet_hdr  *hdr, uint8_t ttl, uint8_t type) {
-	uint32_t nonce;
-	hdr->type = type;
-	hdr->version = L3ROAMD_PACKET_FORMAT_VERSION;
-	hdr->ttl = ttl;
-	hdr->empty = 0;
-	obtainrandom(&nonce, sizeof(uint32_t), 0);
-	hdr->nonce = htonl(nonce);
-	memcpy(&hdr->sender, &l3ctx.intercom_ctx.ip, 16);
+	*hdr = l3ctx.intercom_ctx.templates[type];
+	hdr->ttl = hdr->initial_ttl = ttl;
+	hdr->nonce = random_u32();
 
 	return sizeof(intercom_packet_hdr);
 }
@@ -236,6 +322,15 @@ int assemble_seek_address(uint8_t *packet, const struct in6_addr *address) {
 	return packet[1];
 }
 
+int assemble_found_address(uint8_t *packet, const struct in6_addr *address) {
+	packet[0] = FOUND_ADDRESS;
+	packet[1] = 20;
+	packet[2] = packet[3] = 0;
+	memcpy(&packet[4], address, 16);
+
+	return packet[1];
+}
+
 int assemble_macinfo(uint8_t *packet, uint8_t *mac, uint8_t type) {
 	packet[0] = type;
 	packet[1] = 8;
@@ -252,44 +347,222 @@ uint8_t assemble_platinfo(uint8_t *packet) {
 	return packet[1];
 }
 
-uint8_t assemble_basicinfo(uint8_t *packet, struct client *client) {
-	uint8_t num_addresses = 0;
+/** The number of addresses that fit into an INFO_PREFIXED segment with a prefix of \e len bytes, keeping it within the size of a full INFO_BASIC segment */
+static inline int prefixed_max(int len) {
+	return (8 + INFO_MAX * sizeof(intercom_packet_info_entry) - sizeof(intercom_packet_info_prefixed) - len) / (16 - len);
+}
+
+/**
+   Appends an INFO_PREFIXED segment for the active addresses of \e client that
+   share the first \e len bytes with address \e first and were not sent yet.
+   The number of addresses is stored in \e count. Returns the number of bytes
+   written.
+*/
+static int assemble_prefixed(uint8_t *packet, struct client *client, bool *sent, int first, int len, int *count) {
+	intercom_packet_info_prefixed *segment = (intercom_packet_info_prefixed*)packet;
+	const struct in6_addr *prefix = &VECTOR_INDEX(client->addresses, first).addr;
+	uint8_t *suffix = packet + sizeof(*segment) + len;
+	int num_addresses = 0;
+
+	segment->type = INFO_PREFIXED;
+	memcpy(segment->mac, client->mac, ETH_ALEN);
+	segment->prefixlen = len * 8;
+	memcpy(packet + sizeof(*segment), prefix->s6_addr, len);
+
+	for (int i = first; i < VECTOR_LEN(client->addresses) && num_addresses < prefixed_max(len); i++) {
+		const struct in6_addr *addr = &VECTOR_INDEX(client->addresses, i).addr;
+
+		if (sent[i] || memcmp(addr->s6_addr, prefix->s6_addr, len))
+			continue;
+
+		memcpy(suffix, &addr->s6_addr[len], 16 - len);
+		suffix += 16 - len;
+		sent[i] = true;
+		num_addresses++;
+	}
+
+	*count = num_addresses;
+	segment->length = suffix - packet;
+	return segment->length;
+}
+
+/**
+   Appends the active addresses of \e client as INFO_PREFIXED and INFO_BASIC segments
+
+   If \e prefixed is set, addresses that share a /96 or /64 prefix with at
+   least one other address are sent as a prefixed segment carrying the prefix only once, using the
+   longer prefix if all of them share it. The remaining addresses are sent in
+   full as INFO_BASIC segments of at most INFO_MAX addresses. There are at most
+   INFO_SEGMENTS_MAX segments, all carrying the MAC of the client. At least one
+   segment is emitted even if the client has no active address. Returns the
+   number of bytes written.
+*/
+int assemble_basicinfo(uint8_t *packet, struct client *client, bool prefixed) {
+	int offset = 0, total = 0, segments = 0, left = 0;
+	int n = VECTOR_LEN(client->addresses);
+	bool sent[n + 1];
+
+	for (int i = 0; i < n; i++) {
+		sent[i] = !ip_is_active(&VECTOR_INDEX(client->addresses, i));
+		if (!sent[i])
+			left++;
+	}
+
+	// keep a segment for the addresses that do not share a prefix
+	for (int i = 0; prefixed && i < n && segments < INFO_SEGMENTS_MAX - 1; i++) {
+		if (sent[i])
+			continue;
+
+		const struct in6_addr *addr = &VECTOR_INDEX(client->addresses, i).addr;
+		int shared64 = 0, shared96 = 0;
+
+		for (int j = i + 1; j < n; j++) {
+			const struct in6_addr *other = &VECTOR_INDEX(client->addresses, j).addr;
+
+			if (sent[j] || memcmp(addr->s6_addr, other->s6_addr, 8))
+				continue;
+
+			shared64++;
+			if (!memcmp(addr->s6_addr, other->s6_addr, 12))
+				shared96++;
+		}
+
+		if (!shared64)
+			continue;
+
+		int count;
+		offset += assemble_prefixed(packet + offset, client, sent, i, shared96 == shared64 ? 12 : 8, &count);
+		total += count;
+		left -= count;
+		segments++;
+	}
 
-	packet[0] = INFO_BASIC;
-	memcpy(&packet[2], client->mac, 6);
+	for (int i = 0; (left > 0 || !offset) && segments < INFO_SEGMENTS_MAX; ) {
+		uint8_t *start = packet + offset;
+		uint8_t num_addresses = 0;
 
-	intercom_packet_info_entry *entry = (intercom_packet_info_entry*)((uint8_t*)(packet) + sizeof(client->mac) + 2 );
+		start[0] = INFO_BASIC;
+		memcpy(&start[2], client->mac, 6);
 
-	for (int i = 0; i < VECTOR_LEN(client->addresses) && num_addresses < INFO_MAX; i++) {
-		struct client_ip *ip = &VECTOR_INDEX(client->addresses, i);
-		if (ip_is_active(ip)) {
-			memcpy(&entry->address, ip->addr.s6_addr, sizeof(uint8_t) * 16);
+		intercom_packet_info_entry *entry = (intercom_packet_info_entry*)(start + sizeof(client->mac) + 2);
+
+		for (; i < n && num_addresses < INFO_MAX; i++) {
+			if (sent[i])
+				continue;
+
+			memcpy(&entry->address, VECTOR_INDEX(client->addresses, i).addr.s6_addr, sizeof(uint8_t) * 16);
 			entry++;
 			num_addresses++;
 		}
+
+		// fill length field
+		start[1] = num_addresses * sizeof(intercom_packet_info_entry) + sizeof(client->mac) + 2;
+		offset += start[1];
+		total += num_addresses;
+		left -= num_addresses;
+		segments++;
 	}
 
+	if (left > 0)
+		log_error("client %s has too many addresses, %i of them do not fit into the info packet\n", print_mac(client->mac), left);
+
 	if (l3ctx.debug) {
-		log_debug("added %i addresses to info packet for client ", num_addresses);
+		log_debug("added %i addresses to info packet for client ", total);
 		print_client(client);
 	}
 
-	// fill length field
-	packet[1] = num_addresses * sizeof(intercom_packet_info_entry) + sizeof(client->mac) + 2;
-	return packet[1];
+	return offset;
+}
+
+
+static void send_seek(intercom_ctx *ctx, uint8_t *packet, int packet_len) {
+	intercom_recently_seen_add(ctx, &((intercom_packet_seek*)packet)->hdr);
+	intercom_queue_commit(ctx, packet_len);
+	ctx->stats.seek_packets++;
+}
+
+/**
+   Sends the addresses collected by intercom_seek() with a TTL of \e ttl, packing as many of them into a packet as the MTU allows
+
+   The packets are assembled directly in the send queue.
+*/
+static void flush_seeks(intercom_ctx *ctx, uint8_t ttl) {
+	int max = ctx->mtu - INTERCOM_HEADROOM;
+	uint8_t *packet = NULL;
+	int offset = 0;
+
+	for (int i = 0; i < VECTOR_LEN(ctx->seek_pending); i++) {
+		struct intercom_seek_request *request = &VECTOR_INDEX(ctx->seek_pending, i);
+		if (request->ttl != ttl)
+			continue;
+
+		if (offset && offset + 20 > max) {
+			send_seek(ctx, packet, offset);
+			offset = 0;
+		}
+
+		if (!offset) {
+			packet = intercom_queue_reserve(ctx, max);
+			offset = assemble_header(&((intercom_packet_seek*)packet)->hdr, ttl, INTERCOM_SEEK);
+		}
+
+		offset += assemble_seek_address(packet + offset, &request->address);
+	}
+
+	if (offset)
+		send_seek(ctx, packet, offset);
+}
+
+static void seek_flush_task(void *d) {
+	intercom_ctx *ctx = d;
+	int last = 0;
+
+	// addresses sought with different TTLs go into separate packets
+	while (true) {
+		int ttl = 256;
+		for (int i = 0; i < VECTOR_LEN(ctx->seek_pending); i++) {
+			uint8_t t = VECTOR_INDEX(ctx->seek_pending, i).ttl;
+			if (t > last && t < ttl)
+				ttl = t;
+		}
+
+		if (ttl == 256)
+			break;
+
+		flush_seeks(ctx, ttl);
+		last = ttl;
+	}
+
+	ctx->stats.seek_addresses += VECTOR_LEN(ctx->seek_pending);
+	VECTOR_RESIZE(ctx->seek_pending, 0);
 }
 
+/**
+   Seeks an address on the mesh. The SEEK is forwarded by at most \e ttl - 1
+   nodes. Addresses sought within INTERCOM_SEEK_WINDOW are sent together.
+*/
+void intercom_seek(intercom_ctx *ctx, const struct in6_addr *address, uint8_t ttl) {
+	struct intercom_seek_request request = {
+		.address = *address,
+		.ttl = ttl ? ttl : 255,
+	};
+
+	if (!VECTOR_LEN(ctx->seek_pending))
+		post_task(&l3ctx.taskqueue_ctx, 0, INTERCOM_SEEK_WINDOW, seek_flush_task, NULL, ctx);
 
-void intercom_seek(intercom_ctx *ctx, const struct in6_addr *address) {
-	intercom_packet_seek *packet = l3roamd_alloc(sizeof(intercom_packet_seek) + 20);
+	VECTOR_ADD(ctx->seek_pending, request);
+}
 
-	int offset = assemble_header(&packet->hdr, 255, INTERCOM_SEEK);
-	offset += assemble_seek_address((void*)packet + offset, address);
+/** Asks the node \e recipient whether it serves \e address. Returns false if the SEEK could not be sent. */
+bool intercom_seek_unicast(intercom_ctx *ctx, const struct in6_addr *address, const struct in6_addr *recipient) {
+	uint8_t packet[sizeof(intercom_packet_seek) + 20];
+	int packet_len;
 
-	intercom_recently_seen_add(ctx, &packet->hdr);
+	// unicast, the recipient must not forward it
+	packet_len = assemble_header(&((intercom_packet_seek*)packet)->hdr, 1, INTERCOM_SEEK);
+	packet_len += assemble_seek_address(packet + packet_len, address);
 
-	intercom_send_packet(ctx, (uint8_t*)packet, offset);
-	free(packet);
+	return intercom_send_packet_unicast(ctx, recipient, packet, packet_len);
 }
 
 bool intercom_send_packet_unicast(intercom_ctx *ctx, const struct in6_addr *recipient, uint8_t *packet, ssize_t packet_len) {
@@ -299,51 +572,497 @@ bool intercom_send_packet_unicast(intercom_ctx *ctx, const struct in6_addr *reci
 			.sin6_addr = *recipient
 	};
 
+	struct intercom_destination dest = {
+		.recipient = *recipient,
+	};
+
+	// keep the order of datagrams while the queue waits for the socket
+	if (ctx->sendq_blocked || destination_held(ctx, &dest))
+		return queue_unicast(ctx, recipient, packet, packet_len);
+
 	// printf("fd: %i, packet %p, length: %zi\n", ctx->unicast_nodeip_fd, packet, packet_len);
 	ssize_t rc = sendto(ctx->unicast_nodeip_fd, packet, packet_len, 0, (struct sockaddr*)&addr, sizeof(addr));
 	log_debug("sent intercom packet rc: %zi to %s\n", rc, print_ip(recipient));
 
+	if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		block_sendq(ctx);
+		return queue_unicast(ctx, recipient, packet, packet_len);
+	}
+
+	if (rc < 0 && errno == ENOBUFS) {
+		hold_destination(ctx, &dest);
+		return queue_unicast(ctx, recipient, packet, packet_len);
+	}
+
 	if (rc < 0)
 		perror("sendto failed (if this was a claim and there is a >Permission denied< then this is ok, the client is new to the network)"); // How could we catch this better?
 
 	return rc >= 0;
 }
 
-void intercom_send_packet(intercom_ctx *ctx, uint8_t *packet, ssize_t packet_len) {
+static void free_address(void *d) {
+	l3roamd_pool_free(&l3ctx.intercom_ctx.address_pool, d);
+}
+
+static void forget_seekers_task(void *d) {
+	hashmap_remove(&l3ctx.intercom_ctx.seekers, d);
+}
+
+/** Records that the node \e seeker looks for \e address, so it can be told once the address shows up here */
+static void remember_seeker(intercom_ctx *ctx, const struct in6_addr *address, const struct in6_addr *seeker) {
+	struct intercom_seekers *seekers = hashmap_put(&ctx->seekers, address, NULL);
+	int i;
+
+	for (i = 0; i < seekers->len; i++) {
+		if (!memcmp(&seekers->nodes[i], seeker, sizeof(*seeker)))
+			break;
+	}
+
+	// the most recent seeker replaces the last one if the list is full
+	if (i == seekers->len) {
+		if (seekers->len < INTERCOM_SEEKERS_MAX)
+			seekers->len++;
+		else
+			i--;
+
+		seekers->nodes[i] = *seeker;
+	}
+
+	taskqueue_key_t key = taskqueue_key(TASK_KEY_SEEKERS, address, sizeof(*address));
+	struct in6_addr *data = l3roamd_pool_alloc(&ctx->address_pool);
+	*data = *address;
+	post_keyed_task(&l3ctx.taskqueue_ctx, &key, TASK_REPLACE, INTERCOM_SEEKERS_TIMEOUT, 0, forget_seekers_task, free_address, data);
+}
+
+/** Tells the node \e recipient that \e address is served by this node */
+static void send_found(intercom_ctx *ctx, const struct in6_addr *recipient, const struct in6_addr *address) {
+	uint8_t packet[sizeof(intercom_packet_found) + 20];
+	int packet_len;
+
+	// unicast, the recipient must not forward it
+	packet_len = assemble_header(&((intercom_packet_found*)packet)->hdr, 1, INTERCOM_FOUND);
+	packet_len += assemble_found_address(packet + packet_len, address);
+
+	log_debug("sending FOUND for %s to %s\n", print_ip(address), print_ip(recipient));
+	if (intercom_send_packet_unicast(ctx, recipient, packet, packet_len))
+		ctx->stats.found_sent++;
+}
+
+/** Answers the nodes that recently sought \e address. This is called when the address becomes active on this node. */
+void intercom_address_found(intercom_ctx *ctx, const struct in6_addr *address) {
+	struct intercom_seekers *s = hashmap_get(&ctx->seekers, address);
+	if (!s)
+		return;
+
+	struct intercom_seekers seekers = *s;
+	hashmap_remove(&ctx->seekers, address);
+
+	taskqueue_key_t key = taskqueue_key(TASK_KEY_SEEKERS, address, sizeof(*address));
+	cancel_task(&l3ctx.taskqueue_ctx, &key);
+
+	for (int i = 0; i < seekers.len; i++)
+		send_found(ctx, &seekers.nodes[i], address);
+}
+
+/**
+   Reserves \e len bytes at the end of the send queue, so a packet can be assembled in place
+
+   The packet is queued by intercom_queue_commit(). The returned pointer is
+   only valid until then.
+*/
+uint8_t *intercom_queue_reserve(intercom_ctx *ctx, size_t len) {
+	// datagrams dropped from a blocked queue leave gaps in the buffer
+	if ((ctx->sendq_blocked || VECTOR_LEN(ctx->sendq_held)) && VECTOR_LEN(ctx->sendq_buf) > 2 * (VECTOR_LEN(ctx->sendq) + 1) * ctx->mtu)
+		compact_sendq(ctx);
+
+	size_t offset = VECTOR_LEN(ctx->sendq_buf);
+
+	VECTOR_RESIZE(ctx->sendq_buf, offset + len);
+	ctx->sendq_reserved = offset;
+
+	return &VECTOR_INDEX(ctx->sendq_buf, offset);
+}
+
+/** The send priority of a packet, lower is sent first: answers before CLAIMs before SEEKs */
+static uint8_t send_priority(const uint8_t *packet) {
+	switch (((const intercom_packet_hdr*)packet)->type) {
+		case INTERCOM_ACK:
+		case INTERCOM_INFO:
+		case INTERCOM_FOUND:
+			return 0;
+		case INTERCOM_CLAIM:
+			return 1;
+		default:
+			return 2;
+	}
+}
+
+static inline bool same_destination(const struct intercom_destination *a, const struct intercom_destination *b) {
+	if (a->ifindex || b->ifindex)
+		return a->ifindex == b->ifindex;
+
+	return !memcmp(&a->recipient, &b->recipient, sizeof(struct in6_addr));
+}
+
+static bool destination_held(intercom_ctx *ctx, const struct intercom_destination *dest) {
+	for (size_t i = 0; i < VECTOR_LEN(ctx->sendq_held); i++) {
+		if (same_destination(&VECTOR_INDEX(ctx->sendq_held, i), dest))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+   Adds a datagram to the send queue
+
+   The queue is flushed once per main loop iteration and only bounded for
+   destinations that cannot be sent to, i.e. all while the socket buffer is
+   full or a single one whose interface queue is full. Each of them may hold
+   INTERCOM_SENDQ_MAX datagrams, so a stalled destination cannot push out
+   the datagrams of others. If the destination is full, its newest datagram
+   of the lowest priority is dropped to make room, or the new one if no
+   queued datagram has a lower priority. Returns false if the new datagram was
+   dropped.
+*/
+static bool sendq_add(intercom_ctx *ctx, const struct intercom_queued_packet *q) {
+	if (ctx->sendq_blocked || destination_held(ctx, &q->dest)) {
+		size_t count = 0, victim = SIZE_MAX;
+
+		for (size_t i = 0; i < VECTOR_LEN(ctx->sendq); i++) {
+			struct intercom_queued_packet *a = &VECTOR_INDEX(ctx->sendq, i);
+
+			if (!same_destination(&a->dest, &q->dest))
+				continue;
+
+			count++;
+
+			struct intercom_queued_packet *v = victim == SIZE_MAX ? NULL : &VECTOR_INDEX(ctx->sendq, victim);
+			if (!v || a->priority > v->priority || (a->priority == v->priority && a->offset > v->offset))
+				victim = i;
+		}
+
+		if (count >= INTERCOM_SENDQ_MAX) {
+			ctx->stats.send_dropped++;
+			if (VECTOR_INDEX(ctx->sendq, victim).priority <= q->priority)
+				return false;
+
+			VECTOR_DELETE(ctx->sendq, victim);
+		}
+	}
+
+	VECTOR_ADD(ctx->sendq, *q);
+	return true;
+}
+
+/** Queues the first \e packet_len bytes reserved by intercom_queue_reserve() for all usable mesh interfaces */
+void intercom_queue_commit(intercom_ctx *ctx, size_t packet_len) {
+	size_t offset = ctx->sendq_reserved;
+	uint8_t priority = send_priority(&VECTOR_INDEX(ctx->sendq_buf, offset));
+	bool queued = false;
+
 	for (int i = 0; i < VECTOR_LEN(ctx->interfaces); i++) {
 		intercom_if_t *iface = &VECTOR_INDEX(ctx->interfaces, i);
-		int fd = ctx->unicast_nodeip_fd;
 
 		if (!iface->ok)
 			continue;
 
-		struct sockaddr_in6 _groupaddr = {};
-		memcpy(&_groupaddr, &ctx->groupaddr, sizeof(struct sockaddr_in6));
+		struct intercom_queued_packet q = {
+			.offset = offset,
+			.len = packet_len,
+			.priority = priority,
+			.dest.ifindex = iface->ifindex,
+		};
+		if (sendq_add(ctx, &q))
+			queued = true;
+	}
+
+	VECTOR_RESIZE(ctx->sendq_buf, queued ? offset + packet_len : offset);
+}
+
+/** Queues a packet for all usable mesh interfaces. It is sent by the next intercom_flush(). */
+void intercom_send_packet(intercom_ctx *ctx, uint8_t *packet, ssize_t packet_len) {
+	memcpy(intercom_queue_reserve(ctx, packet_len), packet, packet_len);
+	intercom_queue_commit(ctx, packet_len);
+}
+
+/** Queues a unicast packet that the socket did not take. Returns false if it was dropped. */
+static bool queue_unicast(intercom_ctx *ctx, const struct in6_addr *recipient, const uint8_t *packet, size_t packet_len) {
+	uint8_t *p = intercom_queue_reserve(ctx, packet_len);
+	memcpy(p, packet, packet_len);
+
+	struct intercom_queued_packet q = {
+		.offset = ctx->sendq_reserved,
+		.len = packet_len,
+		.priority = send_priority(p),
+		.dest.recipient = *recipient,
+	};
+
+	bool queued = sendq_add(ctx, &q);
+	VECTOR_RESIZE(ctx->sendq_buf, queued ? q.offset + packet_len : q.offset);
+	return queued;
+}
+
+static int compare_queued_offset(const void *a, const void *b) {
+	const struct intercom_queued_packet *qa = a, *qb = b;
+
+	if (qa->offset != qb->offset)
+		return qa->offset < qb->offset ? -1 : 1;
 
-		_groupaddr.sin6_scope_id = iface->ifindex;
+	return qa->dest.ifindex < qb->dest.ifindex ? -1 : qa->dest.ifindex > qb->dest.ifindex;
+}
+
+static int compare_queued_priority(const void *a, const void *b) {
+	const struct intercom_queued_packet *qa = a, *qb = b;
+
+	if (qa->priority != qb->priority)
+		return qa->priority < qb->priority ? -1 : 1;
+
+	return compare_queued_offset(a, b);
+}
+
+/** Moves the datagrams that are still queued to the front of the buffer, dropping the contents of all others */
+static void compact_sendq(intercom_ctx *ctx) {
+	size_t len = VECTOR_LEN(ctx->sendq), end = 0, last = SIZE_MAX, moved = 0;
+
+	qsort(&VECTOR_INDEX(ctx->sendq, 0), len, sizeof(struct intercom_queued_packet), compare_queued_offset);
+
+	for (size_t i = 0; i < len; i++) {
+		struct intercom_queued_packet *q = &VECTOR_INDEX(ctx->sendq, i);
+
+		// the copies of a multicast packet for all interfaces share their contents
+		if (q->offset != last) {
+			last = q->offset;
+			memmove(&VECTOR_INDEX(ctx->sendq_buf, end), &VECTOR_INDEX(ctx->sendq_buf, q->offset), q->len);
+			moved = end;
+			end += q->len;
+		}
+
+		q->offset = moved;
+	}
+
+	VECTOR_RESIZE(ctx->sendq_buf, end);
+}
+
+static void sendq_retry_task(void *d) {
+	intercom_ctx *ctx = d;
+
+	VECTOR_RESIZE(ctx->sendq_held, 0);
+	intercom_flush(ctx);
+}
+
+/**
+   Stops sending until the socket buffer drains, which is signalled by EPOLLOUT
+
+   All destinations share the socket, so all of them wait.
+*/
+static void block_sendq(intercom_ctx *ctx) {
+	if (ctx->sendq_blocked)
+		return;
+
+	ctx->sendq_blocked = true;
+	ctx->stats.send_blocked++;
+	log_debug("intercom send queue blocked: socket buffer full\n");
+
+	mod_fd(l3ctx.efd, ctx->unicast_nodeip_fd, EPOLLIN | EPOLLOUT);
+}
+
+/**
+   Stops sending to a destination whose interface queue is full (ENOBUFS)
+
+   This is not signalled by epoll, sending to the held destinations is retried
+   after INTERCOM_ENOBUFS_DELAY. Other destinations are not affected.
+*/
+static void hold_destination(intercom_ctx *ctx, const struct intercom_destination *dest) {
+	if (destination_held(ctx, dest))
+		return;
+
+	if (!VECTOR_LEN(ctx->sendq_held))
+		post_task(&l3ctx.taskqueue_ctx, 0, INTERCOM_ENOBUFS_DELAY, sendq_retry_task, NULL, ctx);
 
-		ssize_t rc = sendto(fd, packet, packet_len, 0, (struct sockaddr*)&_groupaddr, sizeof(struct sockaddr_in6));
-		log_debug("sent intercom packet to %s on iface %s rc: %zi\n",print_ip(&_groupaddr.sin6_addr) , iface->ifname,rc);
-		if (rc < 0)
+	VECTOR_ADD(ctx->sendq_held, *dest);
+	ctx->stats.send_blocked++;
+	log_debug("intercom send queue holds %s: interface queue full\n", dest->ifindex ? "a mesh interface" : print_ip(&dest->recipient));
+}
+
+/** Handles EPOLLOUT on the intercom socket: the socket takes datagrams again */
+void intercom_handle_out(intercom_ctx *ctx) {
+	mod_fd(l3ctx.efd, ctx->unicast_nodeip_fd, EPOLLIN);
+
+	ctx->sendq_blocked = false;
+	intercom_flush(ctx);
+}
+
+static void mark_interface_failed(intercom_ctx *ctx, unsigned int ifindex) {
+	for (int i = 0; i < VECTOR_LEN(ctx->interfaces); i++) {
+		intercom_if_t *iface = &VECTOR_INDEX(ctx->interfaces, i);
+
+		if (iface->ifindex == ifindex) {
+			log_debug("sending intercom packet on iface %s failed\n", iface->ifname);
 			iface->ok = false;
+		}
 	}
 }
 
-bool intercom_recently_seen(intercom_ctx *ctx, intercom_packet_hdr *hdr) {
-	for (int i = 0; i < VECTOR_LEN(ctx->recent_packets); i++) {
-		intercom_packet_hdr *ref_hdr = &VECTOR_INDEX(ctx->recent_packets, i);
+/**
+   Sends a batch of queued datagrams with as few syscalls as possible
+
+   Datagrams that were sent or failed for good get a length of 0. The others
+   stay queued: all of them if the socket buffer is full, or those of a
+   destination whose interface queue is full.
+*/
+static void flush_batch(intercom_ctx *ctx, struct intercom_queued_packet **batch, size_t count) {
+	struct sockaddr_in6 addrs[count];
+	struct iovec iovs[count];
+	struct mmsghdr msgs[count];
+
+	memset(msgs, 0, sizeof(msgs));
+	for (size_t i = 0; i < count; i++) {
+		struct intercom_queued_packet *q = batch[i];
+
+		addrs[i] = ctx->groupaddr;
+		if (q->dest.ifindex)
+			addrs[i].sin6_scope_id = q->dest.ifindex;
+		else
+			addrs[i].sin6_addr = q->dest.recipient;
+
+		iovs[i].iov_base = &VECTOR_INDEX(ctx->sendq_buf, q->offset);
+		iovs[i].iov_len = q->len;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
 
-		if (ref_hdr->nonce == hdr->nonce && ref_hdr->type == hdr->type)
-			return true;
+	// sendmmsg() stops at the first datagram that fails, skip it and carry on with the rest
+	size_t sent = 0;
+	while (sent < count) {
+		int rc = sendmmsg(ctx->unicast_nodeip_fd, &msgs[sent], count - sent, 0);
+		ctx->stats.send_syscalls++;
+
+		if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			block_sendq(ctx);
+			return;
+		}
+
+		if (rc < 0 && errno == ENOBUFS) {
+			hold_destination(ctx, &batch[sent]->dest);
+
+			// leave the datagrams of the held destination queued
+			size_t n = sent;
+			for (size_t i = sent; i < count; i++) {
+				if (destination_held(ctx, &batch[i]->dest))
+					continue;
+
+				batch[n] = batch[i];
+				msgs[n++] = msgs[i];
+			}
+			count = n;
+			continue;
+		}
+
+		if (rc < 0) {
+			log_debug("sending intercom packet failed: %s\n", strerror(errno));
+			// unicast datagrams are routed, their failure says nothing about a mesh interface
+			if (batch[sent]->dest.ifindex)
+				mark_interface_failed(ctx, batch[sent]->dest.ifindex);
+			batch[sent++]->len = 0;
+			continue;
+		}
+
+		for (int i = 0; i < rc; i++)
+			batch[sent++]->len = 0;
+		ctx->stats.send_datagrams += rc;
 	}
-	return false;
+}
+
+/**
+   Sends the queued packets, highest priority first. Called once per main loop iteration.
+
+   Datagrams the socket does not take are kept until EPOLLOUT or the retry
+   timer allows sending them.
+*/
+void intercom_flush(intercom_ctx *ctx) {
+	size_t len = VECTOR_LEN(ctx->sendq), count = 0, kept = 0;
+	struct intercom_queued_packet *batch[INTERCOM_SEND_BATCH];
+
+	if (!len || ctx->sendq_blocked)
+		return;
+
+	qsort(&VECTOR_INDEX(ctx->sendq, 0), len, sizeof(struct intercom_queued_packet), compare_queued_priority);
+
+	for (size_t i = 0; i < len && !ctx->sendq_blocked; i++) {
+		struct intercom_queued_packet *q = &VECTOR_INDEX(ctx->sendq, i);
+
+		if (destination_held(ctx, &q->dest))
+			continue;
+
+		batch[count++] = q;
+		if (count == INTERCOM_SEND_BATCH) {
+			flush_batch(ctx, batch, count);
+			count = 0;
+		}
+	}
+
+	if (count && !ctx->sendq_blocked)
+		flush_batch(ctx, batch, count);
+
+	// keep what the socket did not take, in order
+	for (size_t i = 0; i < len; i++) {
+		struct intercom_queued_packet *q = &VECTOR_INDEX(ctx->sendq, i);
+
+		if (q->len)
+			VECTOR_INDEX(ctx->sendq, kept++) = *q;
+	}
+
+	log_debug("sent %zu of %zu queued intercom packets\n", len - kept, len);
+
+	if (!kept) {
+		VECTOR_RESIZE(ctx->sendq, 0);
+		VECTOR_RESIZE(ctx->sendq_buf, 0);
+		return;
+	}
+
+	VECTOR_RESIZE(ctx->sendq, kept);
+	compact_sendq(ctx);
+}
+
+static struct intercom_packet_id packet_id(const intercom_packet_hdr *hdr) {
+	struct intercom_packet_id id = {
+		.nonce = hdr->nonce,
+		.type = hdr->type,
+	};
+	memcpy(id.sender, hdr->sender, sizeof(id.sender));
+	return id;
+}
+
+bool intercom_recently_seen(intercom_ctx *ctx, intercom_packet_hdr *hdr) {
+	struct intercom_packet_id id = packet_id(hdr);
+	return hashmap_get(&ctx->recent_index, &id);
 }
 
 void intercom_recently_seen_add(intercom_ctx *ctx, intercom_packet_hdr *hdr) {
-	while (VECTOR_LEN(ctx->recent_packets) > INTERCOM_MAX_RECENT)
-		VECTOR_DELETE(ctx->recent_packets, 0);
+	if (!ctx->recent)
+		ctx->recent = l3roamd_new_array(ctx->recent_max, struct intercom_packet_id);
+
+	// forget the oldest packet. Retries of our own packets may occupy several slots.
+	if (ctx->recent_len == ctx->recent_max) {
+		struct intercom_packet_id *oldest = &ctx->recent[ctx->recent_next];
+		uint32_t *count = hashmap_get(&ctx->recent_index, oldest);
 
-	VECTOR_ADD(ctx->recent_packets, *hdr);
+		if (count && !--*count)
+			hashmap_remove(&ctx->recent_index, oldest);
+	}
+	else {
+		ctx->recent_len++;
+	}
+
+	struct intercom_packet_id id = packet_id(hdr);
+	ctx->recent[ctx->recent_next] = id;
+	ctx->recent_next = (ctx->recent_next + 1) % ctx->recent_max;
+
+	uint32_t *count = hashmap_put(&ctx->recent_index, &id, NULL);
+	(*count)++;
 }
 
 int parse_address(const uint8_t *packet, struct in6_addr *address) {
@@ -358,6 +1077,21 @@ int parse_mac(const uint8_t *packet, mac *claim) {
 	return packet[1];
 }
 
+/**
+   Returns the number of bytes to skip for an unknown segment
+
+   A segment that is too short or exceeds the packet cannot be skipped
+   reliably, in that case the rest of the packet is skipped.
+*/
+static int skip_segment(const uint8_t *segment, int remaining, const char *packet_type) {
+	log_error("unknown segment of type %i found in %s packet. ignoring this piece\n", segment[0], packet_type);
+
+	if (remaining < 2 || segment[1] < 2 || segment[1] > remaining)
+		return remaining;
+
+	return segment[1];
+}
+
 int parse_plat(const uint8_t *packet, struct client *client) {
 	log_debug("parsing info packet plat\n");
 	memcpy(&l3ctx.clientmgr_ctx.platprefix, &packet[4], 16);
@@ -389,12 +1123,46 @@ int parse_basic(const uint8_t *packet,  struct client *client) {
 	return length;
 }
 
+/** Parses an INFO_PREFIXED segment, adding its addresses to \e client */
+int parse_prefixed(const uint8_t *packet, struct client *client) {
+	const intercom_packet_info_prefixed *segment = (const intercom_packet_info_prefixed*)packet;
+	int len = segment->prefixlen / 8;
+
+	if (segment->length < sizeof(*segment) || segment->prefixlen % 8 || len == 0 || len >= 16 || segment->length < sizeof(*segment) + len) {
+		log_error("malformed prefixed info segment, ignoring it\n");
+		return segment->length;
+	}
+
+	memcpy(client->mac, segment->mac, ETH_ALEN);
+	int num_addresses = (segment->length - sizeof(*segment) - len) / (16 - len);
+
+	log_debug("handling prefixed info segment with %i addresses in /%i\n", num_addresses, segment->prefixlen);
+
+	struct client_ip ip = { 0 };
+	ip.state = IP_INACTIVE;
+	memcpy(ip.addr.s6_addr, packet + sizeof(*segment), len);
+
+	const uint8_t *suffix = packet + sizeof(*segment) + len;
+
+	for (int i = 0; i < num_addresses; i++) {
+		memcpy(&ip.addr.s6_addr[len], suffix, 16 - len);
+		VECTOR_ADD(client->addresses, ip);
+		log_debug("%s learnt from info packet\n", print_ip(&ip.addr));
+		suffix += 16 - len;
+	}
+
+	return segment->length;
+}
+
 // handler returns true if packet should be forwarded
 bool intercom_handle_seek(intercom_ctx *ctx, intercom_packet_seek *packet, int packet_len) {
 	struct in6_addr address= {};
 	int currentoffset = sizeof(intercom_packet_info);
 	uint8_t *packetpointer;
 	uint8_t type;
+	struct in6_addr sender;
+
+	memcpy(&sender.s6_addr, &packet->hdr.sender, sizeof(uint8_t) * 16);
 
 	while (currentoffset < packet_len) {
 		packetpointer = &((uint8_t*)packet)[currentoffset];
@@ -406,13 +1174,24 @@ bool intercom_handle_seek(intercom_ctx *ctx, intercom_packet_seek *packet, int p
 
 				printf("\x1b[36mSEEK: Looking for %s\x1b[0m\n", print_ip(&address));
 
+				// answer right away if the address is served here, otherwise once it shows up
+				struct client *client = NULL;
+				struct client_ip *ip = NULL;
+				if (clientmgr_is_known_address(CTX(clientmgr), &address, &client))
+					ip = get_client_ip(client, &address);
+
+				if (ip && ip->state == IP_ACTIVE)
+					send_found(ctx, &sender, &address);
+				else
+					remember_seeker(ctx, &address, &sender);
+
 				if (address_is_ipv4(&address))
 					arp_send_request(CTX(arp), &address);
 				else
 					icmp6_send_solicitation(CTX(icmp6), &address);
 				break;
 			default:
-				log_error("unknown segment of type %i found in info packet. ignoring this piece\n", type);
+				currentoffset += skip_segment(packetpointer, packet_len - currentoffset, "seek");
 				break;
 
 		}
@@ -427,6 +1206,7 @@ bool intercom_handle_claim(intercom_ctx *ctx, intercom_packet_claim *packet, int
 	uint8_t type;
 
 	mac claim = { };
+	bool handled = true;
 	memcpy(&sender.s6_addr, &packet->hdr.sender, sizeof(uint8_t) * 16);
 
 	if (!memcmp(sender.s6_addr, ctx->ip.s6_addr, 16)) {
@@ -444,40 +1224,110 @@ bool intercom_handle_claim(intercom_ctx *ctx, intercom_packet_claim *packet, int
 		switch (type) {
 			case CLAIM_MAC:
 				currentoffset += parse_mac(packetpointer, &claim);
+				// forward the claim if any of its clients is not served here
+				if (!clientmgr_handle_claim(CTX(clientmgr), &sender, claim.mac))
+					handled = false;
 				break;
 			default:
-				log_error("unknown segment of type %i found in info packet. ignoring this piece\n", type);
+				currentoffset += skip_segment(packetpointer, packet_len - currentoffset, "claim");
 				break;
 
 		}
 	}
 
-	return !clientmgr_handle_claim(CTX(clientmgr), &sender, claim.mac);
+	return !handled;
 }
 
 
-/* find an entry in a vector containing elements of type client_t */
-struct client *find_repeatable (void *v, client_t *k, int *elementindex )
-{
-	client_v vec = *(client_v*)v;
+/** Starts an exchange for a client and returns its serial */
+static uint32_t exchange_start(intercom_ctx *ctx, hashmap_t *exchanges, const uint8_t mac[ETH_ALEN]) {
+	uint64_t key = mac2key(mac);
+	struct intercom_exchange *e = hashmap_put(exchanges, &key, NULL);
+
+	e->serial = ++ctx->exchange_serial;
+	e->sent = (struct timespec){};
+	e->retransmitted = false;
+	return e->serial;
+}
 
-	client_t key = { };
-	memcpy(key.mac, k->mac, ETH_ALEN);
+/** Records that a packet of an exchange was sent. Only the first one is timed. */
+static void exchange_sent(hashmap_t *exchanges, const uint8_t mac[ETH_ALEN], bool retry) {
+	uint64_t key = mac2key(mac);
+	struct intercom_exchange *e = hashmap_get(exchanges, &key);
 
-	// TODO: replace this with VECTOR_BSEARCH
-	struct client *ret = (struct client*)VECTOR_LSEARCH ( &key, vec, client_compare_by_mac );
+	if (!e)
+		return;
 
-	if (ret != NULL) {
-		log_debug( "match on vector for mac %s", print_mac( k->mac ));
+	if (retry)
+		e->retransmitted = true;
+	else
+		clock_gettime(CLOCK_MONOTONIC, &e->sent);
+}
 
-		if (elementindex != NULL ) {
-			*elementindex = ( ( void* ) ret - ( void* ) &VECTOR_INDEX ( vec, 0 ) ) / sizeof ( struct unknown_address );
-			log_debug ( " on index %i", *elementindex );
-		}
+/** Updates the round trip time estimation of \e peer as described in RFC 6298 */
+static void rtt_sample(struct intercom_peer *peer, uint32_t rtt) {
+	if (!peer->samples) {
+		peer->srtt = rtt;
+		peer->rttvar = rtt / 2;
+	} else {
+		uint32_t delta = peer->srtt > rtt ? peer->srtt - rtt : rtt - peer->srtt;
+		peer->rttvar = (3 * peer->rttvar + delta) / 4;
+		peer->srtt = (7 * peer->srtt + rtt) / 8;
 	}
 
-	log_debug ( "\n" );
-	return ret;
+	peer->samples++;
+	peer->rto = peer->srtt + (peer->rttvar ? 4 * peer->rttvar : 1);
+
+	if (peer->rto < INTERCOM_RTO_MIN)
+		peer->rto = INTERCOM_RTO_MIN;
+	else if (peer->rto > INTERCOM_RTO_MAX)
+		peer->rto = INTERCOM_RTO_MAX;
+}
+
+/** Returns the retransmission timeout for packets to \e recipient, or \e initial if nothing was measured yet */
+static uint16_t intercom_rto(intercom_ctx *ctx, const struct in6_addr *recipient, uint16_t initial) {
+	struct intercom_peer *peer = recipient ? hashmap_get(&ctx->peers, recipient) : NULL;
+
+	if (peer && peer->samples)
+		return peer->rto;
+
+	if (ctx->mesh.samples)
+		return ctx->mesh.rto;
+
+	return initial;
+}
+
+/** Checks whether there is an exchange for a client. With a \e serial other than 0 it has to be that exchange. */
+static bool exchange_pending(hashmap_t *exchanges, const uint8_t mac[ETH_ALEN], uint32_t serial) {
+	uint64_t key = mac2key(mac);
+	struct intercom_exchange *e = hashmap_get(exchanges, &key);
+
+	return e && (!serial || e->serial == serial);
+}
+
+/**
+   Ends an exchange. If it was answered by \e sender and no packet of it was
+   retransmitted (Karn's algorithm), the round trip time is sampled.
+*/
+static bool exchange_finish(intercom_ctx *ctx, hashmap_t *exchanges, const uint8_t mac[ETH_ALEN], const struct in6_addr *sender) {
+	uint64_t key = mac2key(mac);
+	struct intercom_exchange *e = hashmap_get(exchanges, &key);
+
+	if (!e)
+		return false;
+
+	if (sender && !e->retransmitted && (e->sent.tv_sec || e->sent.tv_nsec)) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		uint32_t rtt = (now.tv_sec - e->sent.tv_sec) * 1000 + (now.tv_nsec - e->sent.tv_nsec) / 1000000;
+		log_debug("round trip time to %s: %u ms\n", print_ip(sender), rtt);
+
+		rtt_sample(hashmap_put(&ctx->peers, sender, NULL), rtt);
+		rtt_sample(&ctx->mesh, rtt);
+	}
+
+	return hashmap_remove(exchanges, &key);
 }
 
 
@@ -485,6 +1335,9 @@ bool intercom_handle_ack(intercom_ctx *ctx, intercom_packet_ack *packet, int pac
 	mac client_mac = {};
 	uint8_t type, *packetpointer;
 	int currentoffset = sizeof(intercom_packet_info);
+	struct in6_addr sender;
+
+	memcpy(&sender.s6_addr, &packet->hdr.sender, sizeof(uint8_t) * 16);
 
 	while (currentoffset < packet_len) {
 		packetpointer = &((uint8_t*)packet)[currentoffset];
@@ -493,22 +1346,15 @@ bool intercom_handle_ack(intercom_ctx *ctx, intercom_packet_ack *packet, int pac
 		switch (type) {
 			case ACK_MAC:
 				currentoffset += parse_mac((uint8_t*)packetpointer, &client_mac);
+				log_verbose("handling ACK packet for Client with mac %s\n", print_mac( client_mac.mac ) );
+				exchange_finish(ctx, &ctx->infos, client_mac.mac, &sender);
 				break;
 			default:
-				log_error("unknown segment of type %i found in ack packet. ignoring this piece\n", type);
+				currentoffset += skip_segment(packetpointer, packet_len - currentoffset, "ack");
 				break;
 		}
 	}
 
-	log_verbose("handling ACK packet for Client with mac %s\n", print_mac( client_mac.mac ) );
-
-	int i = 0;
-	client_t c = {};
-	memcpy(c.mac, client_mac.mac, ETH_ALEN);
-
-	if (find_repeatable(&ctx->repeatable_infos, &c, &i))
-		VECTOR_DELETE(ctx->repeatable_infos, i);
-
 	return false; // never forward acks
 }
 
@@ -517,6 +1363,7 @@ bool intercom_handle_info(intercom_ctx *ctx, intercom_packet_info *packet, int p
 	struct client client = { 0 };
 	int currentoffset = sizeof(intercom_packet_info);
 	struct in6_addr sender;
+	bool have_basic = false;
 
 	memcpy(&sender.s6_addr, &packet->hdr.sender, sizeof(uint8_t) * 16);
 
@@ -527,23 +1374,38 @@ bool intercom_handle_info(intercom_ctx *ctx, intercom_packet_info *packet, int p
 		type = *packetpointer;
 		if (l3ctx.debug)
 			printf("offset: %i %p %p\n", currentoffset, packet ,packetpointer);
+
+		if (packet_len - currentoffset < 2 || packetpointer[1] < 2 || packetpointer[1] > packet_len - currentoffset) {
+			log_error("truncated segment of type %i found in info packet. ignoring the rest of the packet\n", type);
+			break;
+		}
+
 		switch (type) {
 			case INFO_PLAT:
 				currentoffset += parse_plat(packetpointer, &client);
 				break;
 			case INFO_BASIC:
-				currentoffset += parse_basic(packetpointer, &client);
+			case INFO_PREFIXED:
+				// clients with many addresses are spread over several segments, merge them
+				if (have_basic && memcmp(client.mac, &packetpointer[2], ETH_ALEN)) {
+					log_error("info packet carries segments for more than one client, ignoring segment for %s\n", print_mac(&packetpointer[2]));
+					currentoffset += packetpointer[1];
+					break;
+				}
+				have_basic = true;
+				if (type == INFO_BASIC)
+					currentoffset += parse_basic(packetpointer, &client);
+				else
+					currentoffset += parse_prefixed(packetpointer, &client);
 				break;
 			default:
-				log_error("unknown segment of type %i found in info packet. ignoring this piece\n", type);
+				currentoffset += skip_segment(packetpointer, packet_len - currentoffset, "info");
 				break;
 
 		}
 	}
 
-	int i = -1;
-	if (find_repeatable(&ctx->repeatable_claims, &client, &i))
-		VECTOR_DELETE(ctx->repeatable_claims, i);
+	exchange_finish(ctx, &ctx->claims, client.mac, &sender);
 
 	bool acted_on_local_client = clientmgr_handle_info(CTX(clientmgr), &client);
 	intercom_ack(ctx, &sender, &client);
@@ -551,16 +1413,141 @@ bool intercom_handle_info(intercom_ctx *ctx, intercom_packet_info *packet, int p
 	return !acted_on_local_client;
 }
 
+bool intercom_handle_found(intercom_ctx *ctx, intercom_packet_found *packet, int packet_len) {
+	struct in6_addr address = {}, sender;
+	int currentoffset = sizeof(intercom_packet_found);
+	uint8_t *packetpointer;
+
+	memcpy(&sender.s6_addr, &packet->hdr.sender, sizeof(uint8_t) * 16);
+
+	while (currentoffset < packet_len) {
+		packetpointer = &((uint8_t*)packet)[currentoffset];
+		switch (*packetpointer) {
+			case FOUND_ADDRESS:
+				currentoffset += parse_address(packetpointer, &address);
+				log_verbose("FOUND: %s is served by %s\n", print_ip(&address), print_ip(&sender));
+				ctx->stats.found_received++;
+				ipmgr_seek_found(CTX(ipmgr), &address, &sender);
+				break;
+			default:
+				currentoffset += skip_segment(packetpointer, packet_len - currentoffset, "found");
+				break;
+		}
+	}
+
+	return false;
+}
+
+static void free_relay(void *d) {
+	struct intercom_relay *relay = d;
+	hashmap_remove(&l3ctx.intercom_ctx.relays, &relay->id);
+	free(relay);
+}
+
+static void relay_task(void *d) {
+	struct intercom_relay *relay = d;
+	intercom_ctx *ctx = &l3ctx.intercom_ctx;
+	uint32_t *heard = hashmap_get(&ctx->relays, &relay->id);
+
+	if (heard && *heard >= ctx->relay_threshold) {
+		log_debug("not relaying intercom packet, it was heard %u times\n", *heard);
+		ctx->stats.relay_suppressed++;
+		return;
+	}
+
+	intercom_send_packet(ctx, relay->packet, relay->len);
+	ctx->stats.relay_forwarded++;
+}
+
+/**
+   Relays a multicast packet to the mesh interfaces
+
+   With a relay threshold the packet is held back for a random delay of up to
+   INTERCOM_RELAY_DELAY ms. It is dropped if neighbours relayed it at least
+   relay_threshold times in the meantime, since the nodes around us have
+   most likely received it already.
+*/
+static void relay_packet(intercom_ctx *ctx, uint8_t *packet, ssize_t packet_len) {
+	if (!ctx->relay_threshold) {
+		intercom_send_packet(ctx, packet, packet_len);
+		ctx->stats.relay_forwarded++;
+		return;
+	}
+
+	struct intercom_relay *relay = l3roamd_alloc(sizeof(*relay) + packet_len);
+	relay->id = packet_id((intercom_packet_hdr*)packet);
+	relay->len = packet_len;
+	memcpy(relay->packet, packet, packet_len);
+	hashmap_put(&ctx->relays, &relay->id, NULL);
+
+	post_task(&l3ctx.taskqueue_ctx, 0, random_u32() % (INTERCOM_RELAY_DELAY + 1), relay_task, free_relay, relay);
+}
+
+static void peer_purge_task(void *d) {
+	intercom_ctx *ctx = d;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (size_t i = 0; i < HASHMAP_BUCKETS(ctx->peers); i++) {
+		// removing an entry may move another one into this bucket
+		while (HASHMAP_BUCKET_USED(ctx->peers, i)) {
+			struct intercom_peer *peer = hashmap_bucket_value(&ctx->peers, i);
+			if (now.tv_sec - peer->last_seen.tv_sec < INTERCOM_PEER_TIMEOUT)
+				break;
+
+			struct in6_addr addr;
+			memcpy(&addr, hashmap_bucket_key(&ctx->peers, i), sizeof(addr));
+			log_debug("removing %s from the peer table\n", print_ip(&addr));
+			hashmap_remove(&ctx->peers, &addr);
+		}
+	}
+
+	if (HASHMAP_LEN(ctx->peers)) {
+		taskqueue_key_t key = taskqueue_key(TASK_KEY_PEERS, "", 0);
+		post_keyed_task(&l3ctx.taskqueue_ctx, &key, TASK_MERGE, INTERCOM_PEER_PURGE_INTERVAL, 0, peer_purge_task, NULL, ctx);
+	}
+}
+
+/** Records a packet from another node in the peer table */
+void intercom_peer_seen(intercom_ctx *ctx, const intercom_packet_hdr *hdr) {
+	struct in6_addr sender;
+	memcpy(&sender, hdr->sender, sizeof(sender));
+
+	if (!memcmp(&sender, &ctx->ip, sizeof(sender)))
+		return;
+
+	// nodes that are not heard anymore are removed periodically
+	taskqueue_key_t key = taskqueue_key(TASK_KEY_PEERS, "", 0);
+	post_keyed_task(&l3ctx.taskqueue_ctx, &key, TASK_MERGE, INTERCOM_PEER_PURGE_INTERVAL, 0, peer_purge_task, NULL, ctx);
+
+	struct intercom_peer *peer = hashmap_put(&ctx->peers, &sender, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &peer->last_seen);
+	peer->packets++;
+
+	// unicast packets are sent with a TTL of 1, they are routed but never relayed
+	if (hdr->initial_ttl && hdr->ttl <= hdr->initial_ttl)
+		peer->hops = hdr->initial_ttl - hdr->ttl + 1;
+}
+
 void intercom_handle_packet(intercom_ctx *ctx, uint8_t *packet, ssize_t packet_len) {
 	intercom_packet_hdr *hdr = (intercom_packet_hdr*) packet;
 	bool forward = true;
 
 	if (hdr->version == L3ROAMD_PACKET_FORMAT_VERSION) {
 
-		if (intercom_recently_seen(ctx, hdr))
+		if (intercom_recently_seen(ctx, hdr)) {
+			// count copies of packets we are about to relay
+			struct intercom_packet_id id = packet_id(hdr);
+			uint32_t *heard = hashmap_get(&ctx->relays, &id);
+			if (heard)
+				(*heard)++;
+
 			return;
+		}
 
 		intercom_recently_seen_add(ctx, hdr);
+		intercom_peer_seen(ctx, hdr);
+
 		if (hdr->type == INTERCOM_SEEK)
 			forward = intercom_handle_seek(ctx, (intercom_packet_seek*)packet, packet_len);
 
@@ -573,9 +1560,12 @@ void intercom_handle_packet(intercom_ctx *ctx, uint8_t *packet, ssize_t packet_l
 		if (hdr->type == INTERCOM_ACK)
 			forward = intercom_handle_ack(ctx, (intercom_packet_ack*)packet, packet_len);
 
+		if (hdr->type == INTERCOM_FOUND)
+			forward = intercom_handle_found(ctx, (intercom_packet_found*)packet, packet_len);
+
 		hdr->ttl--;
 		if (hdr->ttl > 0 && forward)
-			intercom_send_packet(ctx, packet, packet_len);
+			relay_packet(ctx, packet, packet_len);
 	}
 	else {
 		// if the packet version is unknown we cannot decrement ttl because we do not know where it is in the packet. Also the check whether we have already seen it fails.
@@ -584,15 +1574,51 @@ void intercom_handle_packet(intercom_ctx *ctx, uint8_t *packet, ssize_t packet_l
 	}
 }
 
-void intercom_handle_in(intercom_ctx *ctx, int fd) {
-	ssize_t count;
-	uint8_t buf[ctx->mtu];
+/** Sets up the buffers for receiving up to recv_batch datagrams at once */
+static void setup_recv_buffers(intercom_ctx *ctx) {
+	ctx->recv_msgs = l3roamd_new0_array(ctx->recv_batch, struct mmsghdr);
+	ctx->recv_iovs = l3roamd_new_array(ctx->recv_batch, struct iovec);
+	ctx->recv_bufs = l3roamd_alloc(ctx->recv_batch * ctx->mtu);
+	ctx->recv_cmsgs = l3roamd_alloc(ctx->recv_batch * RECV_CMSG_SPACE);
+
+	for (unsigned int i = 0; i < ctx->recv_batch; i++) {
+		ctx->recv_iovs[i].iov_base = ctx->recv_bufs + i * ctx->mtu;
+		ctx->recv_iovs[i].iov_len = ctx->mtu;
+		ctx->recv_msgs[i].msg_hdr.msg_iov = &ctx->recv_iovs[i];
+		ctx->recv_msgs[i].msg_hdr.msg_iovlen = 1;
+		ctx->recv_msgs[i].msg_hdr.msg_control = ctx->recv_cmsgs + i * RECV_CMSG_SPACE;
+		ctx->recv_msgs[i].msg_hdr.msg_controllen = RECV_CMSG_SPACE;
+	}
+}
+
+/** Returns the interface a datagram was received on, or 0 if it is not known */
+static unsigned int ingress_ifindex(struct msghdr *msg) {
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO)
+			return ((struct in6_pktinfo *)CMSG_DATA(cmsg))->ipi6_ifindex;
+	}
+
+	return 0;
+}
+
+static bool is_mesh_interface(intercom_ctx *ctx, unsigned int ifindex) {
+	for (int i = 0; i < VECTOR_LEN(ctx->interfaces); i++) {
+		if (VECTOR_INDEX(ctx->interfaces, i).ifindex == ifindex)
+			return true;
+	}
+
+	return false;
+}
 
+void intercom_handle_in(intercom_ctx *ctx, int fd) {
 	log_debug("HANDLING INTERCOM PACKET on fd %i using buffersize of %i ", fd, ctx->mtu);
 
+	if (!ctx->recv_msgs)
+		setup_recv_buffers(ctx);
+
 	while (1) {
-		count = read(fd, buf, ctx->mtu);
-		log_debug("- read %zi Bytes of data\n", count);
+		int count = recvmmsg(fd, ctx->recv_msgs, ctx->recv_batch, MSG_DONTWAIT, NULL);
+		log_debug("- received %i datagrams\n", count);
 		if (count == -1) {
 			/* If errno == EAGAIN, that means we have read all
 			   data. So go back to the main loop.
@@ -605,14 +1631,30 @@ void intercom_handle_in(intercom_ctx *ctx, int fd) {
 				perror("read error - this should not happen - going back to main loop");
 			}
 			break;
-		} else if (count == 0) {
-			/* End of file. The remote has closed the
-			   connection. */
-			break;
 		}
 
+		ctx->stats.recv_syscalls++;
+		ctx->stats.recv_datagrams += count;
+
 		// TODO if this is a claim for a local client, we should just stop iterating and get rid of the EBADF check above
-		intercom_handle_packet(ctx, buf, count);
+		for (int i = 0; i < count; i++) {
+			struct msghdr *msg = &ctx->recv_msgs[i].msg_hdr;
+
+			if (fd == ctx->mcast_recv_fd && !is_mesh_interface(ctx, ingress_ifindex(msg))) {
+				ctx->stats.recv_foreign++;
+				log_debug("dropping intercom packet received on interface %u, it is not a mesh interface\n", ingress_ifindex(msg));
+			}
+			else {
+				intercom_handle_packet(ctx, ctx->recv_iovs[i].iov_base, ctx->recv_msgs[i].msg_len);
+			}
+
+			// the kernel shrinks this to the length of the control messages it stored
+			msg->msg_controllen = RECV_CMSG_SPACE;
+		}
+
+		// a partial batch means the socket is drained, save the syscall that would return EAGAIN
+		if (count < ctx->recv_batch)
+			break;
 	}
 }
 
@@ -620,58 +1662,58 @@ void intercom_handle_in(intercom_ctx *ctx, int fd) {
 void info_retry_task(void *d) {
 	struct intercom_task *data = d;
 
-	int repeatable_info_index;
-	if (!find_repeatable(&l3ctx.intercom_ctx.repeatable_infos, data->client, &repeatable_info_index))
+	if (!exchange_pending(&l3ctx.intercom_ctx.infos, data->mac, data->serial))
 		return;
 
+	exchange_sent(&l3ctx.intercom_ctx.infos, data->mac, data->retries_left < INFO_RETRY_MAX);
+
 	if (data->recipient != NULL) {
-		log_debug("sending unicast info with length %i for client %s to %s\n",  data->packet_len, print_mac(data->client->mac), print_ip(data->recipient));
+		log_debug("sending unicast info with length %i for client %s to %s\n",  data->packet_len, print_mac(data->mac), print_ip(data->recipient));
 		intercom_send_packet_unicast(&l3ctx.intercom_ctx, data->recipient, (uint8_t*)(data->packet), data->packet_len);
 	}
 	else {
 		// forward packet to other l3roamd instances
-		log_debug("sending info for client %s to l3roamd neighbours\n", print_mac( data->client->mac) );
+		log_debug("sending info for client %s to l3roamd neighbours\n", print_mac(data->mac) );
 		intercom_recently_seen_add(&l3ctx.intercom_ctx, &((intercom_packet_info*)data->packet)->hdr);
 		intercom_send_packet(&l3ctx.intercom_ctx, data->packet, data->packet_len);
 	}
 
-	if (data->retries_left > 0)
-		schedule_retries(data, 500, info_retry_task);
+	if (data->retries_left > 0 && data->budget > 0)
+		schedule_retries(data);
 	else {
 		// we have not received an ACK message, otherwise we would not have run out of retries => likely packet loss. At some point in time, retries need to stop.
-		VECTOR_DELETE(l3ctx.intercom_ctx.repeatable_infos, repeatable_info_index);
+		exchange_finish(&l3ctx.intercom_ctx, &l3ctx.intercom_ctx.infos, data->mac, NULL);
 	}
 }
 
 bool intercom_info(intercom_ctx *ctx, const struct in6_addr *recipient, struct client *client, bool relinquished) {
-	int i;
-	if (find_repeatable(&ctx->repeatable_infos, client, &i))
+	if (exchange_pending(&ctx->infos, client->mac, 0))
 		return true;
 	else
 		log_debug("Assembling INFO for client [%s]\n", print_mac(client->mac));
 
-	struct intercom_task *data = l3roamd_alloc(sizeof(struct intercom_task));
-	data->packet = l3roamd_alloc(sizeof(intercom_packet_info) + sizeof(intercom_packet_info_plat) +  (8 + INFO_MAX * sizeof(intercom_packet_info_entry)));
+	struct intercom_task *data = l3roamd_pool_alloc(&ctx->task_pool);
+	data->packet = l3roamd_pool_alloc(&ctx->packet_pool);
 
-	data->packet_len = assemble_header(&((intercom_packet_info*)data->packet)->hdr, 255, INTERCOM_INFO);
+	// when sending unicast, do not continue to forward this packet at the destination
+	data->packet_len = assemble_header(&((intercom_packet_info*)data->packet)->hdr, recipient ? 1 : 255, INTERCOM_INFO);
 
 	data->packet_len += assemble_platinfo(data->packet + data->packet_len);
-	data->packet_len += assemble_basicinfo(data->packet + data->packet_len, client);
+	data->packet_len += assemble_basicinfo(data->packet + data->packet_len, client, ctx->info_prefixed);
 
 	// log_debug("current offset: %i\n", data->packet_len);
 
-	VECTOR_ADD(ctx->repeatable_infos, *client);
-
-	data->client = l3roamd_alloc(sizeof(struct client));
-	memcpy(data->client, client,sizeof(struct client));
+	memcpy(data->mac, client->mac, ETH_ALEN);
+	data->serial = exchange_start(ctx, &ctx->infos, client->mac);
 	data->retries_left = INFO_RETRY_MAX;
+	data->timeout = intercom_rto(ctx, recipient, INFO_RTO_INITIAL);
+	data->budget = INFO_RETRY_MAX * INFO_RTO_INITIAL;
 	data->check_task = NULL;
 	data->recipient = NULL;
 
 	if (recipient) {
-		data->recipient = l3roamd_alloc_aligned(sizeof(struct in6_addr), 16);
+		data->recipient = l3roamd_pool_alloc(&ctx->address_pool);
 		memcpy(data->recipient, recipient, sizeof(struct in6_addr));
-		((intercom_packet_info*)data->packet)->hdr.ttl = 1; // when sending unicast, do not continue to forward this packet at the destination
 	}
 
 	data->check_task = post_task(&l3ctx.taskqueue_ctx, 0, 0, info_retry_task, free_intercom_task, data);
@@ -679,112 +1721,183 @@ bool intercom_info(intercom_ctx *ctx, const struct in6_addr *recipient, struct c
 }
 
 
-void claim_retry_task(void *d) {
-	struct intercom_task *data = d;
+/** Returns the key of the claim batches for \e recipient, :: for the multicast group */
+static struct in6_addr batch_key(const struct in6_addr *recipient) {
+	return recipient ? *recipient : in6addr_any;
+}
+
+static void free_claim_batch(void *d) {
+	struct intercom_claim_batch *batch = d;
+	l3roamd_pool_free(&l3ctx.intercom_ctx.address_pool, batch->task.recipient);
+	l3roamd_pool_free(&l3ctx.intercom_ctx.batch_pool, batch);
+}
+
+/** Sends a CLAIM for the clients of a batch that were not answered yet and schedules the next retry */
+static void claim_batch_task(void *d) {
+	struct intercom_claim_batch *batch = d;
+	intercom_ctx *ctx = &l3ctx.intercom_ctx;
 	bool unicast_packet_sent = true;
 
-	int repeatable_claim_index;
-	if (!find_repeatable(&l3ctx.intercom_ctx.repeatable_claims, data->client, &repeatable_claim_index)) {
-		log_debug("could not find repeatable claim for client [%s]. This happens when an INFO packet was received before all claim retry-cycles are spent. Returning.\n", print_mac(data->client->mac));
+	// the batch is sent, further clients go into a new one
+	struct in6_addr key = batch_key(batch->task.recipient);
+	struct intercom_claim_batch **open = hashmap_get(&ctx->claim_batches, &key);
+	if (open && *open == batch)
+		hashmap_remove(&ctx->claim_batches, &key);
+
+	// leave out clients that were answered by an INFO in the meantime
+	int len = 0;
+	for (int i = 0; i < batch->len; i++) {
+		if (exchange_pending(&ctx->claims, batch->clients[i].mac, batch->clients[i].serial))
+			batch->clients[len++] = batch->clients[i];
+	}
+	batch->len = len;
+
+	if (!len)
 		return;
+
+	uint8_t packet[sizeof(intercom_packet_claim) + INTERCOM_BATCH_MAX * 8];
+	// when sending unicast, do not continue to forward this packet at the destination
+	int packet_len = assemble_header(&((intercom_packet_claim*)packet)->hdr, batch->task.recipient ? 1 : 255, INTERCOM_CLAIM);
+
+	for (int i = 0; i < len; i++) {
+		exchange_sent(&ctx->claims, batch->clients[i].mac, batch->task.retries_left < CLAIM_RETRY_MAX);
+		packet_len += assemble_macinfo(packet + packet_len, batch->clients[i].mac, CLAIM_MAC);
 	}
 
-	if (data->recipient != NULL) {
-		log_debug("sending unicast claim for client %02x:%02x:%02x:%02x:%02x:%02x to %s\n",  data->client->mac[0], data->client->mac[1], data->client->mac[2], data->client->mac[3], data->client->mac[4], data->client->mac[5], print_ip(data->recipient));
-		unicast_packet_sent = intercom_send_packet_unicast(&l3ctx.intercom_ctx, data->recipient, (uint8_t*)data->packet, data->packet_len);
+	if (batch->task.recipient != NULL) {
+		log_debug("sending unicast claim for %i clients to %s\n", len, print_ip(batch->task.recipient));
+		unicast_packet_sent = intercom_send_packet_unicast(ctx, batch->task.recipient, packet, packet_len);
 	} else {
-		log_debug("sending multicast claim for client %02x:%02x:%02x:%02x:%02x:%02x\n",  data->client->mac[0], data->client->mac[1], data->client->mac[2], data->client->mac[3], data->client->mac[4], data->client->mac[5]);
-		intercom_recently_seen_add(&l3ctx.intercom_ctx, &((intercom_packet_claim*)data->packet)->hdr);
-		intercom_send_packet(&l3ctx.intercom_ctx, (uint8_t*)&data->packet, data->packet_len);
+		log_debug("sending multicast claim for %i clients\n", len);
+		intercom_recently_seen_add(ctx, &((intercom_packet_claim*)packet)->hdr);
+		intercom_send_packet(ctx, packet, packet_len);
 	}
 
-	if (data->retries_left > 0 && unicast_packet_sent)
-		schedule_retries(data, 300, claim_retry_task);
+	if (batch->task.retries_left > 0 && batch->task.budget > 0 && unicast_packet_sent)
+		schedule_retries(&batch->task);
 	else {
 		// we have not received an info message or sending a unicast claim was not successful
 		// the only valid business reason for this to happens is when there is no route to the client, so it must be new to the network
 		// TODO: what about EINTR EWOULDBLOCK ENOBUFS ENOMEM
 		// => noone knew the client and it is new to the mesh.
 		// => adding the special IP
-		VECTOR_DELETE(l3ctx.intercom_ctx.repeatable_claims, repeatable_claim_index);
-		add_special_ip(&l3ctx.clientmgr_ctx, get_client(data->client->mac));
+		for (int i = 0; i < len; i++) {
+			exchange_finish(ctx, &ctx->claims, batch->clients[i].mac, NULL);
+			add_special_ip(&l3ctx.clientmgr_ctx, get_client(batch->clients[i].mac));
+		}
 	}
 }
 
-void copy_intercom_task(struct intercom_task *old, struct intercom_task *new) {
-	new->client = l3roamd_alloc(sizeof(struct client));
-	memcpy(new->client, old->client,sizeof(struct client));
+/**
+   Schedules the next retry of an exchange after the retransmission timeout.
+   The timeout is jittered by up to 1/8 so retries of many exchanges do not
+   line up, and doubles for every further retry. This must be called from the
+   retry task of the exchange, which is rescheduled in place.
+*/
+void schedule_retries(struct intercom_task *data) {
+	if (data->retries_left == 0)
+		return;
 
-	new->packet_len = old->packet_len;
-	new->packet = l3roamd_alloc(old->packet_len);
-	memcpy(new->packet, old->packet, new->packet_len);
+	uint32_t timeout = data->timeout;
+	timeout = timeout - timeout / 8 + random_u32() % (timeout / 4 + 1);
 
-	new->recipient = NULL;
-	new->check_task = old->check_task;
-	if (old->recipient) {
-		new->recipient = l3roamd_alloc_aligned(sizeof(struct in6_addr), sizeof(struct in6_addr));
-		memcpy(new->recipient, old->recipient, sizeof(struct in6_addr));
-	}
+	data->retries_left--;
+	data->budget = data->budget > timeout ? data->budget - timeout : 0;
+	data->timeout = data->timeout < INTERCOM_RTO_MAX / 2 ? data->timeout * 2 : INTERCOM_RTO_MAX;
 
-	new->retries_left = old->retries_left;
+	reschedule_task(&l3ctx.taskqueue_ctx, data->check_task, timeout / 1000, timeout % 1000);
 }
 
-void schedule_retries(struct intercom_task *data, int ms_timeout, void (*processor)(void *data)  ) {
-	if (data->retries_left == 0)
-		return;
+static int compare_ack_recipient(const void *a, const void *b) {
+	return memcmp(&((const struct intercom_ack_request *)a)->recipient, &((const struct intercom_ack_request *)b)->recipient, sizeof(struct in6_addr));
+}
+
+/** Sends the ACKs collected by intercom_ack(), one packet per recipient */
+static void ack_flush_task(void *d) {
+	intercom_ctx *ctx = d;
+	size_t len = VECTOR_LEN(ctx->ack_pending);
+	uint8_t packet[sizeof(intercom_packet_ack) + INTERCOM_BATCH_MAX * 8];
+	int packet_len = 0, count = 0;
 
-	struct intercom_task *ndata = l3roamd_alloc(sizeof(struct intercom_task));
-	copy_intercom_task(data, ndata);
-	ndata->retries_left--;
+	qsort(&VECTOR_INDEX(ctx->ack_pending, 0), len, sizeof(struct intercom_ack_request), compare_ack_recipient);
 
-	ndata->check_task = post_task(&l3ctx.taskqueue_ctx, 0, ms_timeout, processor, free_intercom_task, ndata);
+	for (size_t i = 0; i < len; i++) {
+		struct intercom_ack_request *request = &VECTOR_INDEX(ctx->ack_pending, i);
+
+		if (!packet_len)
+			packet_len = assemble_header(&((intercom_packet_ack*)packet)->hdr, 1, INTERCOM_ACK);
+
+		packet_len += assemble_macinfo(packet + packet_len, request->mac, ACK_MAC);
+		count++;
+
+		if (i + 1 == len || count == INTERCOM_BATCH_MAX || compare_ack_recipient(request, request + 1)) {
+			intercom_send_packet_unicast(ctx, &request->recipient, packet, packet_len);
+			packet_len = count = 0;
+		}
+	}
+
+	VECTOR_RESIZE(ctx->ack_pending, 0);
 }
 
+/** Acknowledges an INFO. ACKs for the same recipient are sent together once the current events are handled. */
 bool intercom_ack(intercom_ctx *ctx, const struct in6_addr *recipient, struct client *client)
 {
 	log_verbose("sending ACK for client [%s] to %s\n", print_mac(client->mac) , print_ip(recipient));
 
-	intercom_packet_claim *packet = l3roamd_alloc(sizeof(intercom_packet_ack) + 8);
-
-	int currentoffset = assemble_header(&packet->hdr, 255, INTERCOM_ACK);
-	currentoffset += assemble_macinfo((void*)(packet) + currentoffset, client->mac, ACK_MAC);
+	struct intercom_ack_request request = {
+		.recipient = *recipient,
+	};
+	memcpy(request.mac, client->mac, ETH_ALEN);
 
-	intercom_send_packet_unicast(ctx, recipient, (uint8_t*)packet, currentoffset);
+	if (!VECTOR_LEN(ctx->ack_pending))
+		post_task(&l3ctx.taskqueue_ctx, 0, 0, ack_flush_task, NULL, ctx);
 
-	free(packet);
+	VECTOR_ADD(ctx->ack_pending, request);
 	return true;
 }
 
+/**
+   Claims \e client from \e recipient, or from the mesh if \e recipient is NULL.
+   Clients claimed from the same recipient before the current events are
+   handled are sent in a single CLAIM packet; the claim is not delayed.
+*/
 bool intercom_claim(intercom_ctx *ctx, const struct in6_addr *recipient, struct client *client) {
-	int i;
-
-	if (find_repeatable(&l3ctx.intercom_ctx.repeatable_claims, client, &i))
+	if (exchange_pending(&ctx->claims, client->mac, 0))
 		return true;
-	
+
 	log_verbose("CLAIMING client [%s]\n", print_mac(client->mac));
 
-	struct intercom_task *data = l3roamd_alloc(sizeof(struct intercom_task));
-	data->packet = l3roamd_alloc(sizeof(intercom_packet_claim) + 8);
+	struct in6_addr key = batch_key(recipient);
+	struct intercom_claim_batch **open = hashmap_get(&ctx->claim_batches, &key);
+	struct intercom_claim_batch *batch;
 
-	data->packet_len = assemble_header(&((intercom_packet_claim*)data->packet)->hdr, 255, INTERCOM_CLAIM);
-	data->packet_len += assemble_macinfo((void*)(data->packet) + data->packet_len, client->mac, CLAIM_MAC);
+	if (open) {
+		batch = *open;
+	} else {
+		batch = l3roamd_pool_alloc(&ctx->batch_pool);
+		batch->len = 0;
+		batch->task.packet = NULL;
+		batch->task.retries_left = CLAIM_RETRY_MAX;
+		batch->task.timeout = intercom_rto(ctx, recipient, CLAIM_RTO_INITIAL);
+		batch->task.budget = CLAIM_RETRY_MAX * CLAIM_RTO_INITIAL;
+		batch->task.recipient = NULL;
+
+		if (recipient) {
+			batch->task.recipient = l3roamd_pool_alloc(&ctx->address_pool);
+			memcpy(batch->task.recipient, recipient, sizeof(struct in6_addr));
+		}
 
-	VECTOR_ADD(ctx->repeatable_claims, *client);
+		batch->task.check_task = post_task(&l3ctx.taskqueue_ctx, 0, 0, claim_batch_task, free_claim_batch, batch);
+		hashmap_put(&ctx->claim_batches, &key, &batch);
+	}
 
-	data->client = l3roamd_alloc(sizeof(struct client));
-	memcpy(data->client, client, sizeof(struct client));
-	data->retries_left = CLAIM_RETRY_MAX;
-	data->check_task = NULL;
-	data->recipient = NULL;
+	memcpy(batch->clients[batch->len].mac, client->mac, ETH_ALEN);
+	batch->clients[batch->len].serial = exchange_start(ctx, &ctx->claims, client->mac);
+	batch->len++;
 
-	if (recipient) {
-		data->recipient = l3roamd_alloc_aligned(sizeof(struct in6_addr),16);
-		memcpy(data->recipient, recipient, sizeof(struct in6_addr));
-		((intercom_packet_claim*)data->packet)->hdr.ttl = 1; // when sending unicast, do not continue to forward this packet at the destination
-	}
+	if (batch->len == INTERCOM_BATCH_MAX)
+		hashmap_remove(&ctx->claim_batches, &key);
 
 	client->claimed = true;
-
-	data->check_task = post_task(&l3ctx.taskqueue_ctx, 0, 0, claim_retry_task, free_intercom_task, data);
 	return true;
 }
@@ -4,34 +4,66 @@
 #include "if.h"
 #include "clientmgr.h"
 #include "taskqueue.h"
+#include "alloc.h"
+#include "hashmap.h"
 
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
 #define L3ROAMD_PACKET_FORMAT_VERSION 0 
-#define INFO_MAX 15 // this amount * sizeof(in6_addr) + 6 (mac-address) + 2 (type, lenght) must fit into uint8_t. If we have more than 15 IP addresses for a single client, we could implement sending multiple segments of type INFO_BASIC.
+#define INFO_MAX 15 // this amount * sizeof(in6_addr) + 6 (mac-address) + 2 (type, lenght) must fit into uint8_t. Clients with more addresses are sent as multiple segments of type INFO_BASIC.
+#define INFO_SEGMENTS_MAX 4 // the number of INFO_BASIC segments in a single INFO packet. Together with the header this must fit into the minimum IPv6 MTU.
 #define CLAIM_RETRY_MAX 15
 #define INFO_RETRY_MAX 15
+#define CLAIM_RTO_INITIAL 300 // milliseconds until a CLAIM is retried as long as no round trip time was measured
+#define INFO_RTO_INITIAL 500 // milliseconds until an INFO is retried as long as no round trip time was measured
+#define INTERCOM_RTO_MIN 20 // bounds of the retransmission timeout in milliseconds
+#define INTERCOM_RTO_MAX 2000
+#define INTERCOM_DEFAULT_RECV_BATCH 16 // the number of datagrams received per syscall
+#define INTERCOM_SEND_BATCH 64 // the maximum number of datagrams sent per syscall
+#define INTERCOM_SENDQ_MAX 256 // the number of datagrams queued per interface or unicast recipient while the socket does not take more
+#define INTERCOM_ENOBUFS_DELAY 10 // milliseconds until sending is retried after the interface queue was full
+#define INTERCOM_DEFAULT_RECENT 100 // the number of recently seen packets that are remembered to drop duplicates
+#define INTERCOM_SEEK_WINDOW 5 // milliseconds to collect addresses that are sought in a single SEEK packet
+#define INTERCOM_HEADROOM 48 // IPv6 and UDP headers that have to fit into the MTU along with a packet
+#define INTERCOM_SEEKERS_MAX 4 // the number of nodes per address that are told when a sought address shows up
+#define INTERCOM_SEEKERS_TIMEOUT 10 // seconds after the last SEEK for an address until its seekers are forgotten
+#define INTERCOM_BATCH_MAX 64 // the number of clients in a single CLAIM or ACK packet
+#define INTERCOM_PEER_TIMEOUT 600 // seconds after the last packet from a node until it is removed from the peer table
+#define INTERCOM_PEER_PURGE_INTERVAL 60 // seconds between removals of nodes that were not heard for INTERCOM_PEER_TIMEOUT
+#define INTERCOM_RELAY_DELAY 20 // the maximum number of milliseconds a relayed packet is held back to count copies of it sent by neighbours
 
-enum { INTERCOM_SEEK, INTERCOM_CLAIM, INTERCOM_INFO, INTERCOM_ACK };
-enum { INFO_PLAT, INFO_BASIC };
+// the largest packet built by intercom: a full INFO packet
+#define INTERCOM_PACKET_MAX (sizeof(intercom_packet_info) + sizeof(intercom_packet_info_plat) + INFO_SEGMENTS_MAX * (8 + INFO_MAX * sizeof(intercom_packet_info_entry)))
+
+enum { INTERCOM_SEEK, INTERCOM_CLAIM, INTERCOM_INFO, INTERCOM_ACK, INTERCOM_FOUND, INTERCOM_TYPES };
+enum { INFO_PLAT, INFO_BASIC, INFO_PREFIXED };
 enum { CLAIM_MAC };
 enum { ACK_MAC };
 enum { SEEK_ADDRESS };
+enum { FOUND_ADDRESS };
 
 typedef struct __attribute__((__packed__)) {
 	uint8_t version;
 	uint8_t ttl;
 	uint8_t type;
-	uint8_t empty;
+	uint8_t initial_ttl; // the TTL the packet was sent with, 0 from nodes that do not set it
 	uint32_t nonce;
 	uint8_t sender[16];
 } intercom_packet_hdr;
 
+/** Identifies an intercom packet for duplicate suppression */
+struct intercom_packet_id {
+	uint32_t nonce;
+	uint32_t type;
+	uint8_t sender[16];
+};
+
 typedef struct __attribute__((__packed__)) {
 	intercom_packet_hdr hdr;
 	// after this a dynamic buffer is appended to hold TLV - currently just an ipv6 address is allowed
@@ -39,12 +71,36 @@ typedef struct __attribute__((__packed__)) {
 
 typedef struct __attribute__((__packed__)) {
 	intercom_packet_hdr hdr;
-	// after this a dynamic buffer is appended to hold TLV. currently just mac address is allowed
+	// after this a dynamic buffer is appended to hold TLV - the addresses of a SEEK that were found on the sending node
+} intercom_packet_found;
+
+/** An address to be sought in the next SEEK packets */
+struct intercom_seek_request {
+	struct in6_addr address;
+	uint8_t ttl;
+};
+
+/** A multicast packet that is held back before relaying it */
+struct intercom_relay {
+	struct intercom_packet_id id;
+	ssize_t len;
+	uint8_t packet[];
+};
+
+/** The nodes that recently sought an address */
+struct intercom_seekers {
+	int len;
+	struct in6_addr nodes[INTERCOM_SEEKERS_MAX];
+};
+
+typedef struct __attribute__((__packed__)) {
+	intercom_packet_hdr hdr;
+	// after this a dynamic buffer is appended to hold TLV - one mac address per claimed client
 } intercom_packet_claim;
 
 typedef struct __attribute__((__packed__)) {
 	intercom_packet_hdr hdr;
-	// after this a dynamic buffer is appended to hold TLV. currently just mac address is allowed
+	// after this a dynamic buffer is appended to hold TLV - one mac address per acknowledged INFO
 } intercom_packet_ack;
 
 typedef struct __attribute__((__packed__)) {
@@ -63,7 +119,6 @@ typedef struct {
 	uint8_t mac[ETH_ALEN];
 } mac;
 
-typedef  VECTOR(client_t) client_v;
 
 typedef struct __attribute__((__packed__)) {
 	uint8_t type;
@@ -76,22 +131,80 @@ typedef struct __attribute__((__packed__)) {
 	uint8_t address[16];
 } intercom_packet_info_entry;
 
+typedef struct __attribute__((__packed__)) {
+	uint8_t type;
+	uint8_t length;
+	uint8_t mac[ETH_ALEN];
+	uint8_t prefixlen; // in bits, a multiple of 8
+	// afterwards the prefix (prefixlen / 8 bytes) and an array of address suffixes (16 - prefixlen / 8 bytes each) are expected
+} intercom_packet_info_prefixed;
+
 typedef struct intercom_if {
 	char *ifname;
 	unsigned int ifindex;
-	int mcast_recv_fd;
 	bool ok;
 } intercom_if_t;
 
 typedef  VECTOR(intercom_if_t) intercom_if_v;
 
+/** Where a queued datagram is sent: a mesh interface for multicast or a unicast recipient */
+struct intercom_destination {
+	unsigned int ifindex; // the interface of a multicast datagram, 0 for unicast
+	struct in6_addr recipient; // the recipient of a unicast datagram
+};
+
+/** A datagram waiting in the send queue */
+struct intercom_queued_packet {
+	size_t offset; // position of the packet in the queue buffer
+	uint16_t len; // set to 0 by intercom_flush() once the datagram is done with
+	uint8_t priority; // lower is sent first, see send_priority()
+	struct intercom_destination dest;
+};
+
+/** A CLAIM or INFO exchange that is retried until it is answered */
+struct intercom_exchange {
+	uint32_t serial; // tells retries of an earlier exchange for the same client apart
+	struct timespec sent; // when the first packet of the exchange was sent
+	bool retransmitted; // the answer cannot be matched to a single packet, so it yields no round trip time
+};
+
+/** What is known about another node: when it was last heard and the round trip time estimation, in milliseconds */
+struct intercom_peer {
+	uint32_t srtt; // smoothed round trip time
+	uint32_t rttvar; // round trip time variation
+	uint32_t rto; // retransmission timeout
+	uint32_t samples;
+	struct timespec last_seen; // CLOCK_MONOTONIC
+	uint64_t packets; // packets received from the node, without duplicates
+	uint8_t hops; // 1 + the number of nodes that relayed the last packet from the node, 1 for unicast, 0 if unknown
+};
+
 struct intercom_task {
 	uint16_t packet_len;
-	struct client *client;
+	uint8_t mac[ETH_ALEN];
+	uint32_t serial; // the exchange this task belongs to
 	uint8_t *packet;
 	struct in6_addr *recipient;
 	taskqueue_t *check_task;
 	uint8_t retries_left;
+	uint16_t timeout; // milliseconds until the next retry
+	uint32_t budget; // milliseconds that may still be spent on retries
+};
+
+/** Clients that are claimed from the same recipient with a single CLAIM packet and retried together */
+struct intercom_claim_batch {
+	struct intercom_task task; // timing, retries and recipient, the packet is assembled for every retry
+	int len;
+	struct {
+		uint8_t mac[ETH_ALEN];
+		uint32_t serial; // the claim exchange of the client
+	} clients[INTERCOM_BATCH_MAX];
+};
+
+/** An ACK that is sent together with the other ACKs for the same recipient */
+struct intercom_ack_request {
+	struct in6_addr recipient;
+	uint8_t mac[ETH_ALEN];
 };
 
 
@@ -99,20 +212,73 @@ typedef struct {
 	struct in6_addr ip;
 	struct sockaddr_in6 groupaddr;
 	struct l3ctx *l3ctx;
-	VECTOR(intercom_packet_hdr) recent_packets;
+	struct intercom_packet_id *recent; // ring buffer of the last recent_max packets
+	size_t recent_max;
+	size_t recent_next; // the slot to overwrite next
+	size_t recent_len;
+	hashmap_t recent_index; // intercom_packet_id -> number of slots in recent holding it
+	unsigned int relay_threshold; // do not relay a packet that was heard this many times while it was held back, 0 to always relay
+	hashmap_t relays; // intercom_packet_id -> number of copies heard of a packet that is held back
+	bool info_prefixed; // send INFO_PREFIXED segments, nodes that do not know them ignore those addresses
 	intercom_if_v interfaces;
-	client_v repeatable_claims;
-	client_v repeatable_infos;
+	hashmap_t claims; // MAC -> struct intercom_exchange
+	hashmap_t claim_batches; // recipient (:: for the multicast group) -> struct intercom_claim_batch *, batches that still take clients
+	hashmap_t infos; // MAC -> struct intercom_exchange
+	uint32_t exchange_serial;
+	hashmap_t peers; // node IP -> struct intercom_peer, all nodes heard within INTERCOM_PEER_TIMEOUT
+	struct intercom_peer mesh; // round trip times of all nodes, used for nodes without samples
+	hashmap_t seekers; // address -> struct intercom_seekers, for addresses that were sought but are not known here yet
+	intercom_packet_hdr templates[INTERCOM_TYPES]; // pre-filled headers, only TTL and nonce are set per packet
 	int unicast_nodeip_fd;
+	int mcast_recv_fd; // receives the multicast packets of all mesh interfaces
 	int mtu;
+	unsigned int recv_batch;
+	struct mmsghdr *recv_msgs; // recv_batch messages receiving into recv_bufs
+	struct iovec *recv_iovs;
+	uint8_t *recv_bufs;
+	uint8_t *recv_cmsgs; // control messages telling the ingress interface of each datagram
+	VECTOR(struct intercom_seek_request) seek_pending; // addresses to be sought in the next SEEK packets
+	VECTOR(struct intercom_ack_request) ack_pending; // ACKs to be sent once the current events are handled
+	VECTOR(uint8_t) sendq_buf; // packet contents, shared by the datagrams for all interfaces
+	size_t sendq_reserved; // offset of the packet reserved by intercom_queue_reserve()
+	VECTOR(struct intercom_queued_packet) sendq;
+	bool sendq_blocked; // the socket buffer is full, nothing is sent until EPOLLOUT
+	VECTOR(struct intercom_destination) sendq_held; // destinations whose interface queue was full, retried after INTERCOM_ENOBUFS_DELAY
+	struct {
+		uint64_t recv_syscalls;
+		uint64_t recv_datagrams;
+		uint64_t recv_foreign; // datagrams received on the multicast socket from interfaces that are not mesh interfaces
+		uint64_t send_syscalls;
+		uint64_t send_datagrams;
+		uint64_t send_blocked; // flushes stopped because the socket or interface queue was full
+		uint64_t send_dropped; // datagrams dropped because the send queue was full
+		uint64_t seek_addresses;
+		uint64_t seek_packets;
+		uint64_t found_sent;
+		uint64_t found_received;
+		uint64_t relay_forwarded;
+		uint64_t relay_suppressed;
+	} stats;
+	l3roamd_pool_t task_pool; // struct intercom_task
+	l3roamd_pool_t packet_pool; // packets of INTERCOM_PACKET_MAX bytes
+	l3roamd_pool_t batch_pool; // struct intercom_claim_batch
+	l3roamd_pool_t address_pool; // task recipients
 } intercom_ctx;
 
 
 // struct client;
 
+bool intercom_recently_seen(intercom_ctx *ctx, intercom_packet_hdr *hdr);
 void intercom_recently_seen_add(intercom_ctx *ctx, intercom_packet_hdr *hdr);
+uint8_t *intercom_queue_reserve(intercom_ctx *ctx, size_t len);
+void intercom_queue_commit(intercom_ctx *ctx, size_t packet_len);
 void intercom_send_packet(intercom_ctx *ctx, uint8_t *packet, ssize_t packet_len);
-void intercom_seek(intercom_ctx *ctx, const struct in6_addr *address);
+bool intercom_send_packet_unicast(intercom_ctx *ctx, const struct in6_addr *recipient, uint8_t *packet, ssize_t packet_len);
+void intercom_flush(intercom_ctx *ctx);
+void intercom_handle_out(intercom_ctx *ctx);
+void intercom_seek(intercom_ctx *ctx, const struct in6_addr *address, uint8_t ttl);
+bool intercom_seek_unicast(intercom_ctx *ctx, const struct in6_addr *address, const struct in6_addr *recipient);
+void intercom_address_found(intercom_ctx *ctx, const struct in6_addr *address);
 void intercom_init_unicast(intercom_ctx *ctx);
 void intercom_init(intercom_ctx *ctx);
 void intercom_handle_in(intercom_ctx *ctx, int fd);
@@ -120,5 +286,10 @@ bool intercom_add_interface(intercom_ctx *ctx, char *ifname);
 bool intercom_del_interface(intercom_ctx *ctx, char *ifname);
 void intercom_update_interfaces(intercom_ctx *ctx);
 bool intercom_info(intercom_ctx *ctx, const struct in6_addr *recipient, struct client *client, bool relinquished);
+int assemble_header(intercom_packet_hdr *hdr, uint8_t ttl, uint8_t type);
+int assemble_basicinfo(uint8_t *packet, struct client *client, bool prefixed);
+int parse_basic(const uint8_t *packet, struct client *client);
+int parse_prefixed(const uint8_t *packet, struct client *client);
+void intercom_peer_seen(intercom_ctx *ctx, const intercom_packet_hdr *hdr);
 bool intercom_claim(intercom_ctx *ctx, const struct in6_addr *recipient, struct client *client);
 bool intercom_ack(intercom_ctx *ctx, const struct in6_addr *recipient, struct client *client);
@@ -21,6 +21,7 @@
 
 static void seek_task ( void *d );
 static void ipmgr_purge_task ( void *d );
+static void seek_cache_purge_task ( void *d );
 
 
 static int entry_compare_by_address ( const struct unknown_address *a, const struct unknown_address *b )
@@ -62,7 +63,7 @@ void delete_entry ( const struct in6_addr *k )
 }
 
 struct ns_task *create_ns_task ( struct in6_addr *dst, struct timespec tv, int retries, bool force ) {
-	struct ns_task *task = l3roamd_alloc ( sizeof ( struct ns_task ) ); //should this be aligned?
+	struct ns_task *task = l3roamd_pool_alloc ( &l3ctx.ipmgr_ctx.ns_task_pool );
 
 	if (retries < 0 )
 		retries = -1;
@@ -77,17 +78,100 @@ struct ns_task *create_ns_task ( struct in6_addr *dst, struct timespec tv, int r
 
 struct ip_task *create_task ( struct in6_addr *dst )
 {
-	struct ip_task *task = l3roamd_alloc ( sizeof ( struct ip_task ) ); //should this be aligned?
+	struct ip_task *task = l3roamd_pool_alloc ( &l3ctx.ipmgr_ctx.ip_task_pool );
 
 	task->ctx = &l3ctx.ipmgr_ctx;
 	memcpy ( &task->address, dst, sizeof ( struct in6_addr ) );
 	return task;
 }
 
+void free_ns_task ( void *d )
+{
+	struct ns_task *task = d;
+	l3roamd_pool_free ( &task->ctx->ns_task_pool, task );
+}
+
+static void free_ip_task ( void *d )
+{
+	struct ip_task *task = d;
+	l3roamd_pool_free ( &task->ctx->ip_task_pool, task );
+}
+
 taskqueue_t *schedule_purge_task ( struct in6_addr *destination, int timeout )
 {
 	struct ip_task *purge_data = create_task ( destination );
-	return post_task ( &l3ctx.taskqueue_ctx, timeout, 0, ipmgr_purge_task, free, purge_data );
+	return post_task ( &l3ctx.taskqueue_ctx, timeout, 0, ipmgr_purge_task, free_ip_task, purge_data );
+}
+
+static time_t monotonic_seconds ( void )
+{
+	struct timespec now;
+	clock_gettime ( CLOCK_MONOTONIC, &now );
+	return now.tv_sec;
+}
+
+/** Returns the seek cache entry for an address, dropping it if it expired */
+static struct seek_cache_entry *seek_cache_get ( ipmgr_ctx *ctx, const struct in6_addr *addr, time_t now )
+{
+	struct seek_cache_entry *c = hashmap_get ( &ctx->seek_cache, addr );
+
+	if ( c && c->expires <= now ) {
+		hashmap_remove ( &ctx->seek_cache, addr );
+		return NULL;
+	}
+
+	return c;
+}
+
+static struct seek_cache_entry *seek_cache_put ( ipmgr_ctx *ctx, const struct in6_addr *addr )
+{
+	// expired entries of addresses that are not sought again are removed periodically
+	taskqueue_key_t key = taskqueue_key ( TASK_KEY_SEEK_CACHE, "", 0 );
+	post_keyed_task ( CTX ( taskqueue ), &key, TASK_MERGE, SEEK_CACHE_PURGE_INTERVAL, 0, seek_cache_purge_task, NULL, ctx );
+
+	return hashmap_put ( &ctx->seek_cache, addr, NULL );
+}
+
+/** Records a multicast seek that is not answered yet. Every further miss doubles the interval until the next one. */
+static struct seek_cache_entry *seek_cache_miss ( ipmgr_ctx *ctx, const struct in6_addr *addr, time_t now )
+{
+	struct seek_cache_entry *c = seek_cache_put ( ctx, addr );
+	time_t backoff = SEEK_INTERVAL;
+
+	if ( c->found )
+		memset ( c, 0, sizeof ( *c ) );
+
+	c->misses++;
+	for ( unsigned int i = 1; i < c->misses && backoff < SEEK_BACKOFF_MAX; i++ )
+		backoff <<= 1;
+
+	c->retry = now + ( backoff < SEEK_BACKOFF_MAX ? backoff : SEEK_BACKOFF_MAX );
+	c->expires = now + SEEK_MISS_TTL;
+	return c;
+}
+
+static void seek_cache_purge_task ( void *d )
+{
+	ipmgr_ctx *ctx = d;
+	time_t now = monotonic_seconds ();
+
+	for ( size_t i = 0; i < HASHMAP_BUCKETS ( ctx->seek_cache ); i++ ) {
+		// removing an entry may move another one into this bucket
+		while ( HASHMAP_BUCKET_USED ( ctx->seek_cache, i ) ) {
+			struct seek_cache_entry *c = hashmap_bucket_value ( &ctx->seek_cache, i );
+			if ( c->expires > now )
+				break;
+
+			struct in6_addr addr;
+			memcpy ( &addr, hashmap_bucket_key ( &ctx->seek_cache, i ), sizeof ( addr ) );
+			hashmap_remove ( &ctx->seek_cache, &addr );
+		}
+	}
+
+	if ( HASHMAP_LEN ( ctx->seek_cache ) ) {
+		taskqueue_key_t key = taskqueue_key ( TASK_KEY_SEEK_CACHE, "", 0 );
+		post_keyed_task ( CTX ( taskqueue ), &key, TASK_MERGE, SEEK_CACHE_PURGE_INTERVAL, 0, seek_cache_purge_task, NULL, ctx );
+	}
 }
 
 /** This will seek an address by checking locally and if needed querying the network by scheduling a task */
@@ -97,14 +181,58 @@ void ipmgr_seek_address ( ipmgr_ctx *ctx, struct in6_addr *addr )
 		.tv_sec = SEEK_INTERVAL,
 		.tv_nsec = 0,
 	};
+	// an address that is already being sought keeps its running cycles
+	taskqueue_key_t key = taskqueue_key ( TASK_KEY_NS, addr, sizeof ( *addr ) );
 	struct ns_task *ns_data = create_ns_task ( addr, interval, -1, false);
-	post_task ( CTX ( taskqueue ), 0, 0, ipmgr_ns_task, free, ns_data );
+	post_keyed_task ( CTX ( taskqueue ), &key, TASK_MERGE, 0, 0, ipmgr_ns_task, free_ns_task, ns_data );
 
 	// schedule an intercom-seek operation that in turn will only be executed if there is no local client known
+	key = taskqueue_key ( TASK_KEY_SEEK, addr, sizeof ( *addr ) );
 	struct ip_task *data = create_task ( addr );
-	post_task ( CTX ( taskqueue ), 0, 300, seek_task, free, data );
+	post_keyed_task ( CTX ( taskqueue ), &key, TASK_MERGE, 0, 300, seek_task, free_ip_task, data );
+}
+
+/** Stops all neighbour solicitation cycles for an address, e.g. because it answered */
+void ipmgr_cancel_ns ( ipmgr_ctx *ctx, const struct in6_addr *addr )
+{
+	taskqueue_key_t key = taskqueue_key ( TASK_KEY_NS, addr, sizeof ( *addr ) );
+	cancel_task ( CTX ( taskqueue ), &key );
+
+	key = taskqueue_key ( TASK_KEY_DAD, addr, sizeof ( *addr ) );
+	cancel_task ( CTX ( taskqueue ), &key );
 }
 
+/**
+   Another node answered a SEEK for an address. Stop seeking, the packets are
+   delivered once its route appears. If it does not appear within
+   SEEK_FOUND_WAIT, e.g. because the answer was stale, the address is sought
+   again, starting with the node that answered.
+*/
+void ipmgr_seek_found ( ipmgr_ctx *ctx, const struct in6_addr *addr, const struct in6_addr *owner )
+{
+	taskqueue_key_t key = taskqueue_key ( TASK_KEY_NS, addr, sizeof ( *addr ) );
+	cancel_task ( CTX ( taskqueue ), &key );
+
+	// the next seek for this address asks the owner first
+	struct seek_cache_entry *c = seek_cache_put ( ctx, addr );
+	memset ( c, 0, sizeof ( *c ) );
+	c->found = true;
+	c->owner = *owner;
+	c->expires = monotonic_seconds () + SEEK_FOUND_TTL;
+
+	key = taskqueue_key ( TASK_KEY_SEEK, addr, sizeof ( *addr ) );
+	struct unknown_address *e = find_entry ( ctx, addr, NULL );
+	if ( !e ) {
+		cancel_task ( CTX ( taskqueue ), &key );
+		return;
+	}
+
+	e->found_until = monotonic_seconds () + SEEK_FOUND_WAIT;
+	e->owner = *owner;
+
+	struct ip_task *data = create_task ( &e->address );
+	post_keyed_task ( CTX ( taskqueue ), &key, TASK_REPLACE, SEEK_FOUND_WAIT, 0, seek_task, free_ip_task, data );
+}
 
 static bool ismulticast ( const struct in6_addr *addr )
 {
@@ -177,6 +305,11 @@ static bool should_we_really_seek ( struct in6_addr *destination, bool force)
 		}
 	}
 
+	if ( e->found_until > monotonic_seconds () ) {
+		log_debug ( "%s was found on %s, waiting for its route\n", print_ip ( destination ), print_ip ( &e->owner ) );
+		return false;
+	}
+
 	if ( clientmgr_is_known_address ( &l3ctx.clientmgr_ctx, destination, &client ) && client_is_active ( client ) ) {
 		log_error ( "ERROR: seek task was scheduled, there are packets to be delivered to the host: %s, which is a known client. This should never happen. Flushing packets for this destination\n", print_ip ( destination ) );
 		ipmgr_route_appeared ( &l3ctx.ipmgr_ctx, destination );
@@ -267,23 +400,67 @@ void ipmgr_ns_task ( void *d )
 		icmp6_send_solicitation ( &l3ctx.icmp6_ctx, &data->address );
 
 	if ( !! data->retries_left ) {
+		taskqueue_key_t key = taskqueue_key ( data->force ? TASK_KEY_DAD : TASK_KEY_NS, &data->address, sizeof ( data->address ) );
 		struct ns_task *ns_data = create_ns_task ( &data->address, data->interval, data->retries_left -1, data->force );
-		post_task ( &l3ctx.taskqueue_ctx, data->interval.tv_sec, data->interval.tv_nsec, ipmgr_ns_task, free, ns_data );
+		post_keyed_task ( &l3ctx.taskqueue_ctx, &key, TASK_MERGE, data->interval.tv_sec, data->interval.tv_nsec / 1000000, ipmgr_ns_task, free_ns_task, ns_data );
 	}
 }
 
 void seek_task ( void *d )
 {
 	struct ip_task *data = d;
+	ipmgr_ctx *ctx = data->ctx;
+
+	if ( ! should_we_really_seek ( &data->address, false) )
+		return;
+
+	time_t now = monotonic_seconds ();
+	struct seek_cache_entry *c = seek_cache_get ( ctx, &data->address, now );
+	unsigned int interval = SEEK_INTERVAL * 1000;
+	bool sent = false;
+
+	if ( c && c->found ) {
+		// ask the node that served the address recently, the next seek is a multicast again if it does not answer
+		struct in6_addr owner = c->owner;
+		hashmap_remove ( &ctx->seek_cache, &data->address );
+		c = NULL;
+
+		log_verbose ( "seeking %s on %s\n", print_ip ( &data->address ), print_ip ( &owner ) );
+		sent = intercom_seek_unicast ( CTX ( intercom ), &data->address, &owner );
+		if ( sent )
+			ctx->stats.seek_unicast++;
+	}
 
-	if ( should_we_really_seek ( &data->address, false) ) {
+	if ( !sent && c && c->retry > now ) {
+		log_debug ( "not seeking %s on intercom, %u seeks were not answered\n", print_ip ( &data->address ), c->misses );
+		ctx->stats.seek_suppressed++;
+		interval = ( c->retry - now ) * 1000;
+	} else if ( !sent && ctx->seek_ring_ttl && ! ( c && c->ring_ttl == 255 ) ) {
+		// expanding ring: widen the search if nobody within ttl hops answered in time
+		uint8_t ttl = c && c->ring_ttl ? c->ring_ttl : ctx->seek_ring_ttl;
+		printf ( "\x1b[36mseeking on intercom within %i hops for client with the address %s\x1b[0m\n", ttl, print_ip ( &data->address ) );
+
+		intercom_seek ( &l3ctx.intercom_ctx, &data->address, ttl );
+		ctx->stats.seek_multicast++;
+		ctx->stats.seek_ring++;
+
+		c = seek_cache_put ( ctx, &data->address );
+		c->ring_ttl = ttl < 255 / SEEK_RING_FACTOR ? ttl * SEEK_RING_FACTOR : 255;
+		c->expires = now + SEEK_MISS_TTL;
+		interval = SEEK_RING_INTERVAL;
+	} else if ( !sent ) {
 		printf ( "\x1b[36mseeking on intercom for client with the address %s\x1b[0m\n", print_ip ( &data->address ) );
 
-		intercom_seek ( &l3ctx.intercom_ctx, ( const struct in6_addr* ) & ( data->address ) );
+		intercom_seek ( &l3ctx.intercom_ctx, &data->address, 255 );
+		ctx->stats.seek_multicast++;
 
-		struct ip_task *_data = create_task ( &data->address );
-		post_task ( &l3ctx.taskqueue_ctx, SEEK_INTERVAL, 0, seek_task, free, _data );
+		c = seek_cache_miss ( ctx, &data->address, now );
+		interval = ( c->retry - now ) * 1000;
 	}
+
+	taskqueue_key_t key = taskqueue_key ( TASK_KEY_SEEK, &data->address, sizeof ( data->address ) );
+	struct ip_task *_data = create_task ( &data->address );
+	post_keyed_task ( &l3ctx.taskqueue_ctx, &key, TASK_MERGE, interval / 1000, interval % 1000, seek_task, free_ip_task, _data );
 }
 
 void ipmgr_handle_in ( ipmgr_ctx *ctx, int fd )
@@ -350,6 +527,16 @@ void ipmgr_route_appeared ( ipmgr_ctx *ctx, const struct in6_addr *destination )
 {
 	struct unknown_address *e = find_entry ( ctx, destination, NULL );
 
+	// the destination is reachable, stop looking for it
+	taskqueue_key_t key = taskqueue_key ( TASK_KEY_NS, destination, sizeof ( *destination ) );
+	cancel_task ( CTX ( taskqueue ), &key );
+	key = taskqueue_key ( TASK_KEY_SEEK, destination, sizeof ( *destination ) );
+	cancel_task ( CTX ( taskqueue ), &key );
+
+	struct seek_cache_entry *c = hashmap_get ( &ctx->seek_cache, destination );
+	if ( c && !c->found )
+		hashmap_remove ( &ctx->seek_cache, destination );
+
 	if ( !e ) {
 		//        log_debug ( "route appeared for client %s, which is not on the unknown-list.\n", print_ip ( destination ) );
 		return;
@@ -427,5 +614,10 @@ error:
 
 bool ipmgr_init ( ipmgr_ctx *ctx, char *tun_name, unsigned int mtu )
 {
+	l3roamd_pool_init ( &ctx->ns_task_pool, "ns_tasks", sizeof ( struct ns_task ), 32 );
+	l3roamd_pool_init ( &ctx->ip_task_pool, "ip_tasks", sizeof ( struct ip_task ), 32 );
+	hashmap_init ( &ctx->seek_cache, sizeof ( struct in6_addr ), sizeof ( struct seek_cache_entry ), NULL );
+	memset ( &ctx->stats, 0, sizeof ( ctx->stats ) );
+
 	return tun_open ( ctx, tun_name, mtu, "/dev/net/tun" );
 }
@@ -27,6 +27,7 @@
 
 #include "vector.h"
 #include "taskqueue.h"
+#include "alloc.h"
 #include "types.h"
 #include "time.h"
 
@@ -34,19 +35,48 @@
 #include <netinet/in.h>
 #define PACKET_TIMEOUT 5  // drop packet after it sat in the unknown destination-queue for this amount of time
 #define SEEK_INTERVAL 3   // retry a seek every n seconds
+#define SEEK_BACKOFF_MAX 300 // the longest interval between multicast seeks for an address that nobody answers for
+#define SEEK_MISS_TTL 600 // forget about unanswered seeks for an address after this amount of seconds
+#define SEEK_FOUND_TTL 60 // remember the node that served an address for this amount of seconds
+#define SEEK_FOUND_WAIT SEEK_INTERVAL // seconds to wait for the route of an address another node reported to serve before seeking it again
+#define SEEK_CACHE_PURGE_INTERVAL 60 // remove expired seek cache entries every n seconds
+#define SEEK_RING_INTERVAL 500 // milliseconds to wait for an answer before widening an expanding ring seek
+#define SEEK_RING_FACTOR 4 // the TTL of an expanding ring seek grows by this factor on every step
 
 struct unknown_address {
     struct in6_addr address;
     taskqueue_t *check_task;
+    time_t found_until;         // another node reported to serve this address, do not seek it before this point in time
+    struct in6_addr owner;      // the node that reported it
     VECTOR ( struct packet ) packets;
 };
 
+/** The outcome of recent seeks for an address */
+struct seek_cache_entry {
+    bool found;                 // true if owner reported to serve the address, false if seeks went unanswered
+    struct in6_addr owner;
+    unsigned int misses;        // the number of multicast seeks that were not answered
+    uint8_t ring_ttl;           // the TTL of the next expanding ring seek, 255 once the ring covers the whole mesh
+    time_t retry;               // no multicast seek is sent before this point in time
+    time_t expires;
+};
+
 typedef struct {
     struct l3ctx *l3ctx;
     char *ifname;
     VECTOR ( struct unknown_address ) addrs;
     VECTOR ( struct packet ) output_queue;
     int fd;
+    l3roamd_pool_t ns_task_pool;
+    l3roamd_pool_t ip_task_pool;
+    hashmap_t seek_cache; // address -> struct seek_cache_entry
+    uint8_t seek_ring_ttl; // the TTL of the first seek for an address, 0 to always seek the whole mesh
+    struct {
+        uint64_t seek_multicast;
+        uint64_t seek_unicast;
+        uint64_t seek_suppressed; // multicast seeks skipped because of a backoff
+        uint64_t seek_ring; // multicast seeks limited to a number of hops
+    } stats;
 } ipmgr_ctx;
 
 struct ns_task {
@@ -68,5 +98,8 @@ void ipmgr_handle_in ( ipmgr_ctx *ctx, int fd );
 void ipmgr_handle_out ( ipmgr_ctx *ctx, int fd );
 void ipmgr_seek_address ( ipmgr_ctx *ctx, struct in6_addr *addr );
 struct ns_task *create_ns_task ( struct in6_addr *dst, struct timespec tv, int retries, bool force );
+void free_ns_task ( void *d );
+void ipmgr_cancel_ns ( ipmgr_ctx *ctx, const struct in6_addr *addr );
+void ipmgr_seek_found ( ipmgr_ctx *ctx, const struct in6_addr *addr, const struct in6_addr *owner );
 void ipmgr_ns_task ( void *d );
 
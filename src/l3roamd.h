@@ -42,6 +42,7 @@ extern l3ctx_t l3ctx;
 
 void interfaces_changed(int type, const struct ifinfomsg *msg);
 void add_fd(int efd, int fd, uint32_t events);
+void mod_fd(int efd, int fd, uint32_t events);
 void del_fd(int efd, int fd);
 
 #define INTERCOM_PORT 5523
@@ -37,6 +37,7 @@
 #include "types.h"
 #include "alloc.h"
 #include "util.h"
+#include "random.h"
 
 #define SIGTERM_MSG "Exiting. Removing routes for prefixes and clients.\n"
 
@@ -72,15 +73,14 @@ void sig_term_handler ( int signum, siginfo_t *info, void *ptr )
 
 bool intercom_ready ( const int fd )
 {
-    for ( int j=VECTOR_LEN ( l3ctx.intercom_ctx.interfaces ) - 1; j>=0; j-- ) {
-        if ( VECTOR_INDEX ( l3ctx.intercom_ctx.interfaces, j ).mcast_recv_fd == fd ) {
-            log_debug ( "received intercom packet on one of the mesh interfaces\n" );
-            return true;
-        }
+    if ( l3ctx.intercom_ctx.mcast_recv_fd == fd ) {
+        log_debug ( "received intercom packet on one of the mesh interfaces\n" );
+        return true;
     }
 
-    for ( int j=VECTOR_LEN ( l3ctx.clientmgr_ctx.clients ) - 1; j>=0; j-- ) {
-        if ( VECTOR_INDEX ( l3ctx.clientmgr_ctx.clients, j ).fd == fd ) {
+    for ( uint32_t j=0; j < SLAB_CAPACITY ( l3ctx.clientmgr_ctx.clients ); j++ ) {
+        struct client *_client = slab_get ( &l3ctx.clientmgr_ctx.clients, j );
+        if ( _client && _client->fd == fd ) {
             log_debug ( "received intercom packet for a locally connected client\n" );
             return true;
         }
@@ -162,9 +162,7 @@ void loop()
             add_fd ( efd, l3ctx.wifistations_ctx.fd, EPOLLIN );
     }
 
-    for ( int i=VECTOR_LEN ( l3ctx.intercom_ctx.interfaces ) - 1; i>=0; i-- ) {
-        add_fd ( efd, VECTOR_INDEX ( l3ctx.intercom_ctx.interfaces, i ).mcast_recv_fd, EPOLLIN );
-    }
+    add_fd ( efd, l3ctx.intercom_ctx.mcast_recv_fd, EPOLLIN );
 
     if ( l3ctx.socket_ctx.fd >= 0 )
         add_fd ( efd, l3ctx.socket_ctx.fd, EPOLLIN );
@@ -175,11 +173,14 @@ void loop()
 
     /* The event loop */
     while ( 1 ) {
+        // send what the previous iteration queued before waiting again
+        intercom_flush ( &l3ctx.intercom_ctx );
+
         int n = epoll_wait ( efd, events, maxevents, -1 );
         for ( int i = 0; i < n; i++ ) {
             log_debug ( "handling event on fd %i. taskqueue.fd: %i routemgr: %i ipmgr: %i icmp6: %i icmp6.ns: %i arp: %i socket: %i, wifistations: %i, intercom_unicast_nodeip_fd: %i - ", events[i].data.fd, l3ctx.taskqueue_ctx.fd, l3ctx.routemgr_ctx.fd, l3ctx.ipmgr_ctx.fd, l3ctx.icmp6_ctx.fd, l3ctx.icmp6_ctx.nsfd, l3ctx.arp_ctx.fd, l3ctx.socket_ctx.fd, l3ctx.wifistations_ctx.fd, l3ctx.intercom_ctx.unicast_nodeip_fd );
 
-            if ( ( events[i].events & EPOLLERR ) || ( events[i].events & EPOLLHUP ) || ( ! ( events[i].events & EPOLLIN ) ) ) {
+            if ( ( events[i].events & EPOLLERR ) || ( events[i].events & EPOLLHUP ) || ( ! ( events[i].events & ( EPOLLIN | EPOLLOUT ) ) ) ) {
                 fprintf ( stderr, "epoll error received on fd %i. Dumping fd: taskqueue.fd: %i routemgr: %i ipmgr: %i icmp6: %i icmp6.ns: %i arp: %i socket: %i, wifistations: %i ... continuing\n", events[i].data.fd, l3ctx.taskqueue_ctx.fd, l3ctx.routemgr_ctx.fd, l3ctx.ipmgr_ctx.fd, l3ctx.icmp6_ctx.fd, l3ctx.icmp6_ctx.nsfd, l3ctx.arp_ctx.fd, l3ctx.socket_ctx.fd, l3ctx.wifistations_ctx.fd );
                 if ( reconnect_fd ( events[i].data.fd ) )
                     continue;
@@ -222,6 +223,8 @@ void loop()
                 log_debug ( "handling intercom event\n" );
                 if ( events[i].events & EPOLLIN )
                     intercom_handle_in ( &l3ctx.intercom_ctx, events[i].data.fd );
+                if ( events[i].events & EPOLLOUT )
+                    intercom_handle_out ( &l3ctx.intercom_ctx );
             } else {
                 char buffer[512];
                 int tmp = read ( events[i].data.fd, buffer, 512 );
@@ -257,11 +260,18 @@ void usage()
     puts ( "  --no-netlink       do not use fdb or neighbour-table to learn new clients" );
     puts ( "  --no-ndp           do not use ndp to learn new clients" );
     puts ( "  --no-nl80211       do not use nl80211 to learn new clients" );
+    puts ( "  --task-budget <n>  run at most <n> due tasks per timer wakeup, 0 for no limit. Default: 64" );
+    puts ( "  --recent-packets <n> remember the last <n> intercom packets to drop duplicates. Default: 100" );
+    puts ( "  --recv-batch <n>   receive up to <n> intercom packets per syscall. Default: 16" );
+    puts ( "  --seek-ring <ttl>  seek unknown addresses within <ttl> hops first and widen the search if nobody answers. Default: 0 (seek the whole mesh)" );
+    puts ( "  --relay-threshold <k> do not relay an intercom packet that neighbours relayed <k> times within a short delay. Default: 0 (always relay)" );
+    puts ( "  --info-prefixed    send addresses sharing a prefix in compressed INFO segments. Only enable this once all nodes understand them." );
     puts ( "  -h|--help          this help\n" );
 
     puts ( "The socket will accept the following commands:" );
     puts ( "get_clients              The daemon will reply with a json structure, currently providing client count." );
     puts ( "get_prefixes             This return a list of all prefixes being handled by l3roamd." );
+    puts ( "get_stats                The daemon will reply with a json structure of internal counters." );
     puts ( "add_meshif <interface>   Add <interface> to mesh interfaces. Does the same as -m" );
     puts ( "del_meshif <interface>   Remove <interface> from mesh interfaces. Reverts add_meshif" );
     puts ( "add_prefix <prefix>      This will treat <prefix> as if it was added using -p" );
@@ -297,6 +307,7 @@ int main ( int argc, char *argv[] )
     l3ctx.routemgr_ctx.l3ctx = &l3ctx;
     l3ctx.socket_ctx.l3ctx = &l3ctx;
     l3ctx.taskqueue_ctx.l3ctx = &l3ctx;
+    l3ctx.taskqueue_ctx.budget = TASKQUEUE_DEFAULT_BUDGET;
     l3ctx.icmp6_ctx.l3ctx = &l3ctx;
     l3ctx.arp_ctx.l3ctx = &l3ctx;
 
@@ -335,9 +346,17 @@ int main ( int argc, char *argv[] )
         { "no-netlink",     0, NULL, 'F' },
         { "no-nl80211", 0, NULL, 'N' },
         { "no-ndp",     0, NULL, 'X' },
-        { "version",     0, NULL, 'V' }
+        { "version",     0, NULL, 'V' },
+        { "task-budget", 1, NULL, 'T' },
+        { "recent-packets", 1, NULL, 'R' },
+        { "recv-batch", 1, NULL, 'B' },
+        { "seek-ring", 1, NULL, 'S' },
+        { "relay-threshold", 1, NULL, 'K' },
+        { "info-prefixed", 0, NULL, 'I' },
+        { 0, 0, NULL, 0 }
     };
 
+    random_init();
     intercom_init ( &l3ctx.intercom_ctx );
     int c;
     while ( ( c = getopt_long ( argc, argv, "dhva:b:e:p:i:m:t:c:4:n:s:d:VD:P:", long_options, &option_index ) ) != -1 )
@@ -453,6 +472,34 @@ int main ( int argc, char *argv[] )
         case 'X':
             l3ctx.wifistations_ctx.nl80211_disabled = true;
             break;
+        case 'T':
+            if ( atoi ( optarg ) < 0 )
+                exit_error ( "--task-budget must not be negative" );
+            l3ctx.taskqueue_ctx.budget = atoi ( optarg );
+            break;
+        case 'R':
+            if ( atoi ( optarg ) <= 0 )
+                exit_error ( "--recent-packets must be positive" );
+            l3ctx.intercom_ctx.recent_max = atoi ( optarg );
+            break;
+        case 'B':
+            if ( atoi ( optarg ) <= 0 )
+                exit_error ( "--recv-batch must be positive" );
+            l3ctx.intercom_ctx.recv_batch = atoi ( optarg );
+            break;
+        case 'S':
+            if ( atoi ( optarg ) < 0 || atoi ( optarg ) > 255 )
+                exit_error ( "--seek-ring must be between 0 and 255" );
+            l3ctx.ipmgr_ctx.seek_ring_ttl = atoi ( optarg );
+            break;
+        case 'K':
+            if ( atoi ( optarg ) < 0 )
+                exit_error ( "--relay-threshold must not be negative" );
+            l3ctx.intercom_ctx.relay_threshold = atoi ( optarg );
+            break;
+        case 'I':
+            l3ctx.intercom_ctx.info_prefixed = true;
+            break;
         default:
             fprintf ( stderr, "Invalid parameter %c ignored.\n", c );
         }
@@ -0,0 +1,108 @@
+/**
+   \file
+
+   Userspace pseudo random number generator
+*/
+
+
+#include "random.h"
+#include "syscallwrappers.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+
+#define ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) do {			\
+		a += b; d ^= a; d = ROTL(d, 16);	\
+		c += d; b ^= c; b = ROTL(b, 12);	\
+		a += b; d ^= a; d = ROTL(d, 8);		\
+		c += d; b ^= c; b = ROTL(b, 7);		\
+	} while (0)
+
+
+static struct {
+	bool seeded;
+	uint32_t key[8];
+	uint64_t counter;
+	uint8_t buf[32];	/**< Key stream that was not handed out yet, at the end of the buffer */
+	size_t avail;
+} state;
+
+
+/** Computes a block of the ChaCha20 key stream, using a 64 bit block counter and nonce */
+void chacha20_block(uint32_t out[16], const uint32_t key[8], uint64_t counter, uint64_t nonce) {
+	uint32_t in[16] = {
+		0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+		key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+		counter, counter >> 32, nonce, nonce >> 32,
+	};
+	uint32_t x[16];
+
+	memcpy(x, in, sizeof(x));
+
+	for (int i = 0; i < 10; i++) {
+		QUARTERROUND(x[0], x[4], x[8], x[12]);
+		QUARTERROUND(x[1], x[5], x[9], x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8], x[13]);
+		QUARTERROUND(x[3], x[4], x[9], x[14]);
+	}
+
+	for (int i = 0; i < 16; i++)
+		out[i] = x[i] + in[i];
+}
+
+/** Seeds the generator from the kernel. Called once at startup; the generator seeds itself if it is used earlier. */
+void random_init(void) {
+	obtainrandom(state.key, sizeof(state.key), 0);
+	state.counter = 0;
+	state.avail = 0;
+	state.seeded = true;
+}
+
+/** Generates the next block, replacing the key with its first half */
+static void refill(void) {
+	uint32_t block[16];
+
+	chacha20_block(block, state.key, state.counter++, 0);
+	memcpy(state.key, block, sizeof(state.key));
+	memcpy(state.buf, &block[8], sizeof(state.buf));
+	state.avail = sizeof(state.buf);
+
+	memset(block, 0, sizeof(block));
+}
+
+/** Fills \e buf with \e len random bytes */
+void random_bytes(void *buf, size_t len) {
+	uint8_t *p = buf;
+
+	if (!state.seeded)
+		random_init();
+
+	while (len) {
+		if (!state.avail)
+			refill();
+
+		size_t n = len < state.avail ? len : state.avail;
+		uint8_t *src = &state.buf[sizeof(state.buf) - state.avail];
+
+		memcpy(p, src, n);
+		// do not keep output that was handed out
+		memset(src, 0, n);
+
+		state.avail -= n;
+		p += n;
+		len -= n;
+	}
+}
+
+uint32_t random_u32(void) {
+	uint32_t v;
+	random_bytes(&v, sizeof(v));
+	return v;
+}
@@ -0,0 +1,23 @@
+/**
+   \file
+
+   Userspace pseudo random number generator
+
+   Random numbers are taken from a ChaCha20 key stream. The generator is
+   seeded from the kernel once and replaces its key with the first half of
+   every block it generates (fast key erasure), so drawing random numbers
+   needs no syscall and earlier output cannot be recovered from the state.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+void chacha20_block(uint32_t out[16], const uint32_t key[8], uint64_t counter, uint64_t nonce);
+
+void random_init(void);
+void random_bytes(void *buf, size_t len);
+uint32_t random_u32(void);
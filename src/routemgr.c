@@ -42,7 +42,14 @@ void rtmgr_client_remove_address ( struct in6_addr *dst_address )
 {
     struct client *_client = NULL;
     if ( clientmgr_is_known_address ( &l3ctx.clientmgr_ctx, dst_address, &_client ) ) {
+        client_handle_t handle = _client->handle;
         clientmgr_remove_address ( &l3ctx.clientmgr_ctx, _client, dst_address );
+
+        // removing the last address deletes the client
+        _client = clientmgr_resolve ( &l3ctx.clientmgr_ctx, handle );
+        if ( !_client )
+            return;
+
         for ( int i=0; i < VECTOR_LEN ( _client->addresses ); i++ ) {
             routemgr_probe_neighbor ( &l3ctx.routemgr_ctx, _client->ifindex, &VECTOR_INDEX ( _client->addresses, i ).addr, _client->mac );
         }
@@ -0,0 +1,98 @@
+/**
+   \file
+
+   Slab storage for objects that need a stable address
+*/
+
+
+#include "slab.h"
+#include "alloc.h"
+
+#include <string.h>
+
+
+/** The number of elements allocated at once. Must be a power of 2. */
+#define SLAB_CHUNK 32
+
+
+static inline void *slot(const slab_t *slab, uint32_t index) {
+	return slab->chunks[index / SLAB_CHUNK] + (index % SLAB_CHUNK) * slab->elemsize;
+}
+
+void slab_init(slab_t *slab, size_t elemsize) {
+	slab->elemsize = elemsize;
+	slab->length = 0;
+	slab->capacity = 0;
+	slab->chunks = NULL;
+	slab->generations = NULL;
+	VECTOR_INIT(slab->freelist);
+	slab->freelist.data = NULL;
+}
+
+/** Adds a chunk of free slots */
+static void grow(slab_t *slab) {
+	size_t nchunks = slab->capacity / SLAB_CHUNK;
+
+	slab->chunks = l3roamd_realloc(slab->chunks, (nchunks + 1) * sizeof(uint8_t *));
+	slab->chunks[nchunks] = l3roamd_alloc(SLAB_CHUNK * slab->elemsize);
+
+	slab->generations = l3roamd_realloc(slab->generations, (slab->capacity + SLAB_CHUNK) * sizeof(uint32_t));
+	memset(&slab->generations[slab->capacity], 0, SLAB_CHUNK * sizeof(uint32_t));
+
+	// hand out the lowest slots first
+	for (size_t i = slab->capacity + SLAB_CHUNK; i > slab->capacity; i--)
+		VECTOR_ADD(slab->freelist, i - 1);
+
+	slab->capacity += SLAB_CHUNK;
+}
+
+/**
+   Allocates a zeroed element
+
+   The handle of the element is stored in \e handle if it is not NULL.
+*/
+void *slab_alloc(slab_t *slab, slab_handle_t *handle) {
+	if (!VECTOR_LEN(slab->freelist))
+		grow(slab);
+
+	uint32_t index = VECTOR_INDEX(slab->freelist, VECTOR_LEN(slab->freelist) - 1);
+	VECTOR_DELETE(slab->freelist, VECTOR_LEN(slab->freelist) - 1);
+
+	slab->generations[index]++;
+	slab->length++;
+
+	if (handle) {
+		handle->index = index;
+		handle->generation = slab->generations[index];
+	}
+
+	void *elem = slot(slab, index);
+	memset(elem, 0, slab->elemsize);
+	return elem;
+}
+
+/** Returns the slot \e index to the slab. Handles to the element become stale. */
+void slab_free(slab_t *slab, uint32_t index) {
+	if (!slab_get(slab, index))
+		return;
+
+	slab->generations[index]++;
+	slab->length--;
+	VECTOR_ADD(slab->freelist, index);
+}
+
+/** Returns the element in slot \e index or NULL if the slot is not in use */
+void *slab_get(const slab_t *slab, uint32_t index) {
+	if (index >= slab->capacity || !(slab->generations[index] & 1))
+		return NULL;
+
+	return slot(slab, index);
+}
+
+/** Returns the element a handle refers to or NULL if the element was freed in the meantime */
+void *slab_resolve(const slab_t *slab, slab_handle_t handle) {
+	if (handle.index >= slab->capacity || slab->generations[handle.index] != handle.generation)
+		return NULL;
+
+	return slab_get(slab, handle.index);
+}
@@ -0,0 +1,67 @@
+/**
+   \file
+
+   Slab storage for objects that need a stable address
+
+   Elements are allocated in chunks that are never moved, so pointers to
+   elements stay valid until the element is freed. Freed slots are reused.
+   Every slot carries a generation counter that is odd while the slot is in
+   use, so a handle (index and generation) of a freed element can be told
+   apart from the element that reuses its slot later.
+*/
+
+
+#pragma once
+
+#include "vector.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** Refers to an element of a slab */
+typedef struct slab_handle {
+	uint32_t index;			/**< The slot of the element */
+	uint32_t generation;		/**< The generation of the slot when the element was allocated */
+} slab_handle_t;
+
+/** A slab descriptor */
+typedef struct slab {
+	size_t elemsize;		/**< The size of an element */
+	size_t length;			/**< The number of elements in use */
+	size_t capacity;		/**< The number of slots */
+	uint8_t **chunks;		/**< The storage for the slots */
+	uint32_t *generations;		/**< The generation of each slot */
+	VECTOR(uint32_t) freelist;	/**< Slots that may be reused */
+} slab_t;
+
+
+void slab_init(slab_t *slab, size_t elemsize);
+void *slab_alloc(slab_t *slab, slab_handle_t *handle);
+void slab_free(slab_t *slab, uint32_t index);
+void *slab_get(const slab_t *slab, uint32_t index);
+void *slab_resolve(const slab_t *slab, slab_handle_t handle);
+
+
+/**
+   Returns the number of elements in use in the slab \e s
+
+   \hideinitializer
+*/
+#define SLAB_LEN(s) ((s).length)
+
+/**
+   Returns the number of slots of the slab \e s. Use this together with
+   slab_get() to iterate over all elements.
+
+   \hideinitializer
+*/
+#define SLAB_CAPACITY(s) ((s).capacity)
+
+/**
+   Checks whether two handles refer to the same element
+
+   \hideinitializer
+*/
+#define SLAB_HANDLE_EQ(a, b) ((a).index == (b).index && (a).generation == (b).generation)
@@ -25,6 +25,7 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <time.h>
 #include <json-c/json.h>
 
 #include "socket.h"
@@ -108,6 +109,14 @@ bool parse_command(char *cmd, enum socket_command *scmd) {
         *scmd = GET_PREFIX;
         return true;
     }
+    if (!strncmp(cmd, "get_stats", 9)) {
+        *scmd = GET_STATS;
+        return true;
+    }
+    if (!strncmp(cmd, "get_peers", 9)) {
+        *scmd = GET_PEERS;
+        return true;
+    }
     return false;
 }
 
@@ -126,14 +135,113 @@ void socket_get_prefixes(struct json_object *obj) {
     json_object_object_add(obj, "prefixes", jprefixes);
 }
 
+static void socket_add_pool_stats(struct json_object *jpools, l3roamd_pool_t *pool) {
+    struct json_object *jpool = json_object_new_object();
+
+    json_object_object_add(jpool, "in_use", json_object_new_int64(pool->in_use));
+    json_object_object_add(jpool, "high_water", json_object_new_int64(pool->high_water));
+    json_object_object_add(jpool, "allocated", json_object_new_int64(pool->allocated));
+    json_object_object_add(jpools, pool->name, jpool);
+}
+
+void socket_get_stats(struct json_object *obj) {
+    struct json_object *jtaskqueue = json_object_new_object();
+    struct json_object *jpools = json_object_new_object();
+    struct json_object *jintercom = json_object_new_object();
+    struct json_object *jipmgr = json_object_new_object();
+
+    json_object_object_add(jtaskqueue, "wakeups", json_object_new_int64(l3ctx.taskqueue_ctx.stats.wakeups));
+    json_object_object_add(jtaskqueue, "tasks_run", json_object_new_int64(l3ctx.taskqueue_ctx.stats.tasks_run));
+    json_object_object_add(jtaskqueue, "budget_exhausted", json_object_new_int64(l3ctx.taskqueue_ctx.stats.budget_exhausted));
+    json_object_object_add(jtaskqueue, "last_run", json_object_new_int64(l3ctx.taskqueue_ctx.stats.last_run));
+    json_object_object_add(jtaskqueue, "max_run", json_object_new_int64(l3ctx.taskqueue_ctx.stats.max_run));
+    json_object_object_add(jtaskqueue, "budget", json_object_new_int64(l3ctx.taskqueue_ctx.budget));
+    json_object_object_add(obj, "taskqueue", jtaskqueue);
+
+    uint64_t syscalls = l3ctx.intercom_ctx.stats.recv_syscalls;
+    uint64_t datagrams = l3ctx.intercom_ctx.stats.recv_datagrams;
+    json_object_object_add(jintercom, "recv_syscalls", json_object_new_int64(syscalls));
+    json_object_object_add(jintercom, "recv_datagrams", json_object_new_int64(datagrams));
+    json_object_object_add(jintercom, "recv_foreign", json_object_new_int64(l3ctx.intercom_ctx.stats.recv_foreign));
+    json_object_object_add(jintercom, "datagrams_per_syscall", json_object_new_double(syscalls ? (double)datagrams / syscalls : 0));
+    json_object_object_add(jintercom, "send_syscalls", json_object_new_int64(l3ctx.intercom_ctx.stats.send_syscalls));
+    json_object_object_add(jintercom, "send_datagrams", json_object_new_int64(l3ctx.intercom_ctx.stats.send_datagrams));
+    json_object_object_add(jintercom, "send_blocked", json_object_new_int64(l3ctx.intercom_ctx.stats.send_blocked));
+    json_object_object_add(jintercom, "send_dropped", json_object_new_int64(l3ctx.intercom_ctx.stats.send_dropped));
+    json_object_object_add(jintercom, "send_queued", json_object_new_int64(VECTOR_LEN(l3ctx.intercom_ctx.sendq)));
+    json_object_object_add(jintercom, "send_held", json_object_new_int64(VECTOR_LEN(l3ctx.intercom_ctx.sendq_held)));
+    json_object_object_add(jintercom, "seek_addresses", json_object_new_int64(l3ctx.intercom_ctx.stats.seek_addresses));
+    json_object_object_add(jintercom, "seek_packets", json_object_new_int64(l3ctx.intercom_ctx.stats.seek_packets));
+    json_object_object_add(jintercom, "found_sent", json_object_new_int64(l3ctx.intercom_ctx.stats.found_sent));
+    json_object_object_add(jintercom, "found_received", json_object_new_int64(l3ctx.intercom_ctx.stats.found_received));
+    json_object_object_add(jintercom, "relay_forwarded", json_object_new_int64(l3ctx.intercom_ctx.stats.relay_forwarded));
+    json_object_object_add(jintercom, "relay_suppressed", json_object_new_int64(l3ctx.intercom_ctx.stats.relay_suppressed));
+    json_object_object_add(jintercom, "relay_threshold", json_object_new_int64(l3ctx.intercom_ctx.relay_threshold));
+    json_object_object_add(jintercom, "srtt", json_object_new_int64(l3ctx.intercom_ctx.mesh.srtt));
+    json_object_object_add(jintercom, "rto", json_object_new_int64(l3ctx.intercom_ctx.mesh.rto));
+    json_object_object_add(jintercom, "rtt_samples", json_object_new_int64(l3ctx.intercom_ctx.mesh.samples));
+    json_object_object_add(jintercom, "peers", json_object_new_int64(HASHMAP_LEN(l3ctx.intercom_ctx.peers)));
+    json_object_object_add(jintercom, "recv_batch", json_object_new_int64(l3ctx.intercom_ctx.recv_batch));
+    json_object_object_add(obj, "intercom", jintercom);
+
+    json_object_object_add(jipmgr, "seek_multicast", json_object_new_int64(l3ctx.ipmgr_ctx.stats.seek_multicast));
+    json_object_object_add(jipmgr, "seek_unicast", json_object_new_int64(l3ctx.ipmgr_ctx.stats.seek_unicast));
+    json_object_object_add(jipmgr, "seek_suppressed", json_object_new_int64(l3ctx.ipmgr_ctx.stats.seek_suppressed));
+    json_object_object_add(jipmgr, "seek_ring", json_object_new_int64(l3ctx.ipmgr_ctx.stats.seek_ring));
+    json_object_object_add(jipmgr, "seek_cache", json_object_new_int64(HASHMAP_LEN(l3ctx.ipmgr_ctx.seek_cache)));
+    json_object_object_add(obj, "ipmgr", jipmgr);
+
+    socket_add_pool_stats(jpools, &l3ctx.taskqueue_ctx.pool);
+    socket_add_pool_stats(jpools, &l3ctx.ipmgr_ctx.ns_task_pool);
+    socket_add_pool_stats(jpools, &l3ctx.ipmgr_ctx.ip_task_pool);
+    socket_add_pool_stats(jpools, &l3ctx.intercom_ctx.task_pool);
+    socket_add_pool_stats(jpools, &l3ctx.intercom_ctx.packet_pool);
+    socket_add_pool_stats(jpools, &l3ctx.intercom_ctx.batch_pool);
+    socket_add_pool_stats(jpools, &l3ctx.intercom_ctx.address_pool);
+    json_object_object_add(obj, "pools", jpools);
+}
+
+void socket_get_peers(struct json_object *obj) {
+    hashmap_t *peers = &l3ctx.intercom_ctx.peers;
+    struct json_object *jpeers = json_object_new_object();
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (size_t i = 0; i < HASHMAP_BUCKETS(*peers); i++) {
+        if (!HASHMAP_BUCKET_USED(*peers, i))
+            continue;
+
+        struct intercom_peer *peer = hashmap_bucket_value(peers, i);
+        struct json_object *jpeer = json_object_new_object();
+        char str_address[INET6_ADDRSTRLEN] = "";
+
+        inet_ntop(AF_INET6, hashmap_bucket_key(peers, i), str_address, INET6_ADDRSTRLEN);
+
+        json_object_object_add(jpeer, "last_seen", json_object_new_int64(now.tv_sec - peer->last_seen.tv_sec));
+        json_object_object_add(jpeer, "packets", json_object_new_int64(peer->packets));
+        json_object_object_add(jpeer, "hops", json_object_new_int(peer->hops));
+        json_object_object_add(jpeer, "srtt", json_object_new_int64(peer->srtt));
+        json_object_object_add(jpeer, "rttvar", json_object_new_int64(peer->rttvar));
+        json_object_object_add(jpeer, "rto", json_object_new_int64(peer->rto));
+        json_object_object_add(jpeer, "rtt_samples", json_object_new_int64(peer->samples));
+        json_object_object_add(jpeers, str_address, jpeer);
+    }
+
+    json_object_object_add(obj, "peers", jpeers);
+}
+
 void get_clients(struct json_object *obj) {
-    int i = 0, j = 0;
+    int j = 0;
     struct json_object *jclients = json_object_new_object();
 
-    json_object_object_add(obj, "clients", json_object_new_int(VECTOR_LEN(l3ctx.clientmgr_ctx.clients)));
+    json_object_object_add(obj, "clients", json_object_new_int(SLAB_LEN(l3ctx.clientmgr_ctx.clients)));
+
+    for (uint32_t i = 0; i < SLAB_CAPACITY(l3ctx.clientmgr_ctx.clients); i++) {
+        struct client *_client = slab_get(&l3ctx.clientmgr_ctx.clients, i);
+        if (!_client)
+            continue;
 
-    for (i = 0; i < VECTOR_LEN(l3ctx.clientmgr_ctx.clients); i++) {
-        struct client *_client = &VECTOR_INDEX(l3ctx.clientmgr_ctx.clients, i);
         struct json_object *jclient = json_object_new_object();
 
         // char mac[18] = {};
@@ -164,7 +272,7 @@ void get_clients(struct json_object *obj) {
         json_object_object_add(jclients, print_mac( _client->mac), jclient);
     }
 
-    if (i) {
+    if (SLAB_LEN(l3ctx.clientmgr_ctx.clients)) {
         json_object_object_add(obj,"clientlist", jclients);
     }
     else {
@@ -282,6 +390,14 @@ void socket_handle_in(socket_ctx *ctx) {
         socket_get_prefixes(retval);
         dprintf(fd, "%s", json_object_to_json_string(retval));
         break;
+    case GET_STATS:
+        socket_get_stats(retval);
+        dprintf(fd, "%s", json_object_to_json_string(retval));
+        break;
+    case GET_PEERS:
+        socket_get_peers(retval);
+        dprintf(fd, "%s", json_object_to_json_string(retval));
+        break;
     }
 
     json_object_put(retval);
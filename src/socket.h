@@ -18,7 +18,9 @@ enum socket_command {
 	DEL_PREFIX,
 	GET_PREFIX,
 	ADD_ADDRESS,
-	DEL_ADDRESS
+	DEL_ADDRESS,
+	GET_STATS,
+	GET_PEERS
 };
 
 typedef struct {
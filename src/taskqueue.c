@@ -26,6 +26,7 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/timerfd.h>
 
@@ -36,9 +37,60 @@
 #include "l3roamd.h"
 #include "alloc.h"
 
+#ifdef TASKQUEUE_TIMERWHEEL
+/** Returns the last tick that has fully passed at \e now */
+static inline uint64_t passed_tick(struct timespec now) {
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+#endif
+
 void taskqueue_init(taskqueue_ctx *ctx) {
 	ctx->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	l3roamd_pool_init(&ctx->pool, "tasks", sizeof(taskqueue_t), 64);
+	hashmap_init(&ctx->keys, sizeof(taskqueue_key_t), sizeof(taskqueue_t *), NULL);
+	ctx->running = NULL;
+#ifdef TASKQUEUE_TIMERWHEEL
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timerwheel_init(&ctx->wheel, passed_tick(now));
+#else
 	ctx->queue = NULL;
+#endif
+}
+
+/** Adds a task to the scheduler backend */
+static inline void queue_insert(taskqueue_ctx *ctx, taskqueue_t *task) {
+#ifdef TASKQUEUE_TIMERWHEEL
+	timerwheel_insert(&ctx->wheel, task);
+#else
+	taskqueue_insert(&ctx->queue, task);
+#endif
+}
+
+/** Removes a task from the scheduler backend */
+static inline void queue_remove(taskqueue_ctx *ctx, taskqueue_t *task) {
+#ifdef TASKQUEUE_TIMERWHEEL
+	timerwheel_remove(&ctx->wheel, task);
+#else
+	taskqueue_remove(task);
+#endif
+}
+
+/** Removes and returns a task that is due at \e now, or returns NULL if there is none */
+static inline taskqueue_t * queue_pop(taskqueue_ctx *ctx, struct timespec now) {
+#ifdef TASKQUEUE_TIMERWHEEL
+	timerwheel_advance(&ctx->wheel, passed_tick(now));
+	return timerwheel_pop(&ctx->wheel);
+#else
+	taskqueue_t *task = ctx->queue;
+
+	if (task == NULL || timespec_cmp(task->due, now) > 0)
+		return NULL;
+
+	taskqueue_remove(task);
+	return task;
+#endif
 }
 
 /** this will add timeout seconds and millisecs milliseconds to the current time to calculate at which time a task should run given an offset */
@@ -54,35 +106,128 @@ struct timespec settime(unsigned int timeout, unsigned int millisecs) {
 	return timeAdd(&due, &t);
 }
 
-/** Enqueues a new task. A task with a timeout of zero is scheduled immediately. */
-taskqueue_t * post_task(taskqueue_ctx *ctx, unsigned int timeout, unsigned int millisecs, void (*function)(void*), void (*cleanup)(void*), void *data) {
-	taskqueue_t *task = l3roamd_alloc(sizeof(taskqueue_t));
+static taskqueue_t * new_task(taskqueue_ctx *ctx, struct timespec due, void (*function)(void*), void (*cleanup)(void*), void *data) {
+	taskqueue_t *task = l3roamd_pool_alloc(&ctx->pool);
 	task->children = task->next = NULL;
 	task->pprev = NULL;
 
-	task->due = settime(timeout, millisecs);
+	task->due = due;
 
 	task->function = function;
 	task->cleanup = cleanup;
 	task->data = data;
-	taskqueue_insert(&ctx->queue, task);
+	task->keyed = false;
+
+	return task;
+}
+
+/** Unlinks a task that is not going to run, releasing its data */
+static void drop_task(taskqueue_ctx *ctx, taskqueue_t *task) {
+	queue_remove(ctx, task);
+
+	if (task->keyed)
+		hashmap_remove(&ctx->keys, &task->key);
+
+	if (task->cleanup != NULL)
+		task->cleanup(task->data);
+
+	l3roamd_pool_free(&ctx->pool, task);
+}
+
+/** Enqueues a new task. A task with a timeout of zero is scheduled immediately. */
+taskqueue_t * post_task(taskqueue_ctx *ctx, unsigned int timeout, unsigned int millisecs, void (*function)(void*), void (*cleanup)(void*), void *data) {
+	taskqueue_t *task = new_task(ctx, settime(timeout, millisecs), function, cleanup, data);
+
+	queue_insert(ctx, task);
+	taskqueue_schedule(ctx);
+
+	return task;
+}
+
+/**
+   Enqueues a new task that is identified by \e key
+
+   If a task with the same key is pending and \e mode is TASK_MERGE, the
+   pending task is kept and moved forward if the new one would be due
+   earlier; \e data is released using \e cleanup right away. With
+   TASK_REPLACE, the pending task is cancelled. Returns the pending task.
+*/
+taskqueue_t * post_keyed_task(taskqueue_ctx *ctx, const taskqueue_key_t *key, enum taskqueue_post_mode mode, unsigned int timeout, unsigned int millisecs, void (*function)(void*), void (*cleanup)(void*), void *data) {
+	struct timespec due = settime(timeout, millisecs);
+	taskqueue_t *task = find_task(ctx, key);
+
+	if (task && mode == TASK_MERGE) {
+		if (cleanup != NULL)
+			cleanup(data);
+
+		if (timespec_cmp(due, task->due) < 0) {
+			queue_remove(ctx, task);
+			task->due = due;
+			queue_insert(ctx, task);
+			taskqueue_schedule(ctx);
+		}
+
+		return task;
+	}
+
+	if (task)
+		drop_task(ctx, task);
+
+	task = new_task(ctx, due, function, cleanup, data);
+	task->keyed = true;
+	task->key = *key;
+	hashmap_put(&ctx->keys, key, &task);
+
+	queue_insert(ctx, task);
 	taskqueue_schedule(ctx);
 
 	return task;
 }
 
-/** Changes the timeout of a task.
-  */
+/** Returns the pending task identified by \e key or NULL */
+taskqueue_t * find_task(taskqueue_ctx *ctx, const taskqueue_key_t *key) {
+	taskqueue_t **task = hashmap_get(&ctx->keys, key);
+	return task ? *task : NULL;
+}
+
+/** Cancels the pending task identified by \e key. Returns false if there is none. */
+bool cancel_task(taskqueue_ctx *ctx, const taskqueue_key_t *key) {
+	taskqueue_t *task = find_task(ctx, key);
+
+	if (task == NULL)
+		return false;
+
+	drop_task(ctx, task);
+	return true;
+}
+
+/**
+   Changes the timeout of a task
+
+   A running task may reschedule itself. It is then kept along with its data
+   instead of being released once its function returns, so a task that
+   repeats itself needs no new allocation.
+*/
 bool reschedule_task(taskqueue_ctx *ctx, taskqueue_t *task, unsigned int timeout, unsigned int millisecs) {
-	if (task == NULL || !taskqueue_linked(task))
+	if (task == NULL)
 		return false;
 
 	struct timespec due = settime(timeout, millisecs);
 
+	if (task == ctx->running && !taskqueue_linked(task)) {
+		task->due = due;
+		queue_insert(ctx, task);
+		taskqueue_schedule(ctx);
+		return true;
+	}
+
+	if (!taskqueue_linked(task))
+		return false;
+
 	if (timespec_cmp(due, task->due)) {
 		task->due = due;
-		taskqueue_remove(task);
-		taskqueue_insert(&ctx->queue, task);
+		queue_remove(ctx, task);
+		queue_insert(ctx, task);
 		taskqueue_schedule(ctx);
 	}
 
@@ -90,16 +235,30 @@ bool reschedule_task(taskqueue_ctx *ctx, taskqueue_t *task, unsigned int timeout
 }
 
 void taskqueue_schedule(taskqueue_ctx *ctx) {
+#ifdef TASKQUEUE_TIMERWHEEL
+	uint64_t next = timerwheel_next(&ctx->wheel);
+	if (next == UINT64_MAX)
+		return;
+
+	struct itimerspec t = {
+		.it_value = {
+			.tv_sec = next / 1000,
+			.tv_nsec = (next % 1000) * 1000000l,
+		}
+	};
+#else
 	if (ctx->queue == NULL)
 		return;
 
 	struct itimerspec t = {
 		.it_value = ctx->queue->due
 	};
+#endif
 
 	timerfd_settime(ctx->fd, TFD_TIMER_ABSTIME, &t, NULL);
 }
 
+/** Runs all tasks that are due, but at most \e budget of them so other events are not starved */
 void taskqueue_run(taskqueue_ctx *ctx) {
 	log_debug("handling taskqueue event\n");
 	unsigned long long nEvents;
@@ -109,21 +268,45 @@ void taskqueue_run(taskqueue_ctx *ctx) {
 
 	read(ctx->fd, &nEvents, sizeof(nEvents));
 
-	if (ctx->queue == NULL)
-		return;
-
-	taskqueue_t *task = ctx->queue;
+	// tasks posted while running are due after now and wait for the next wakeup
+	unsigned int ran = 0;
+	taskqueue_t *task;
+	while ((!ctx->budget || ran < ctx->budget) && (task = queue_pop(ctx, now))) {
+		// a running task may post its successor under the same key
+		if (task->keyed)
+			hashmap_remove(&ctx->keys, &task->key);
 
-	if (timespec_cmp(task->due, now) <= 0) {
-		taskqueue_remove(task);
+		ctx->running = task;
 		task->function(task->data);
+		ctx->running = NULL;
+		ran++;
+
+		// the task rescheduled itself
+		if (taskqueue_linked(task)) {
+			// unless a successor was posted under its key while it ran
+			if (task->keyed && !find_task(ctx, &task->key))
+				hashmap_put(&ctx->keys, &task->key, &task);
+			else
+				task->keyed = false;
+
+			continue;
+		}
 
 		if (task->cleanup != NULL)
 			task->cleanup(task->data);
 
-		free(task);
+		l3roamd_pool_free(&ctx->pool, task);
 	}
 
+	if (ctx->budget && ran == ctx->budget)
+		ctx->stats.budget_exhausted++;
+
+	ctx->stats.wakeups++;
+	ctx->stats.tasks_run += ran;
+	ctx->stats.last_run = ran;
+	if (ran > ctx->stats.max_run)
+		ctx->stats.max_run = ran;
+
 	taskqueue_schedule(ctx);
 }
 
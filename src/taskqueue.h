@@ -1,17 +1,65 @@
 #pragma once
 
 #include <time.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "alloc.h"
+#include "hashmap.h"
+
+/** The default maximum number of tasks run per timer wakeup */
+#define TASKQUEUE_DEFAULT_BUDGET 64
 
 typedef struct taskqueue taskqueue_t;
 
+/** Identifies a pending task so duplicates can be merged or cancelled */
+typedef struct {
+	uint32_t type;		/**< One of enum taskqueue_key_type */
+	uint8_t id[16];		/**< The object the task is about, e.g. an address, zero-padded */
+} taskqueue_key_t;
+
+enum taskqueue_key_type {
+	TASK_KEY_NS = 1,	// neighbour solicitation cycle while seeking an address
+	TASK_KEY_DAD,		// neighbour solicitation cycle after a client did DAD
+	TASK_KEY_SEEK,		// intercom SEEK cycle
+	TASK_KEY_SEEKERS,	// expiry of the nodes that sought an address
+	TASK_KEY_SEEK_CACHE,	// expiry of the seek cache entries, the id is unused
+	TASK_KEY_PEERS,		// expiry of the intercom peer table, the id is unused
+};
+
+/** What post_keyed_task() does if a task with the same key is pending */
+enum taskqueue_post_mode {
+	TASK_MERGE,		// keep the pending task, run it no later than the new one would have run
+	TASK_REPLACE,		// cancel the pending task and post the new one
+};
+
+#ifdef TASKQUEUE_TIMERWHEEL
+#include "timerwheel.h"
+#endif
+
 typedef struct {
 	struct l3ctx *l3ctx;
+#ifdef TASKQUEUE_TIMERWHEEL
+	timerwheel_t wheel;
+#else
 	taskqueue_t *queue;
+#endif
 	int fd;
+	hashmap_t keys; // taskqueue_key_t -> pending taskqueue_t *
+	taskqueue_t *running; // the task whose function is being run, it may reschedule itself
+	l3roamd_pool_t pool;
+	unsigned int budget; // maximum number of tasks run per wakeup, 0 means unlimited
+	struct {
+		uint64_t wakeups;
+		uint64_t tasks_run;
+		uint64_t budget_exhausted; // wakeups that left due tasks for the next one
+		unsigned int last_run; // tasks run during the last wakeup
+		unsigned int max_run;
+	} stats;
 } taskqueue_ctx;
 
-/** Element of a priority queue */
+/** Element of a priority queue, or of a timing wheel slot when built with TASKQUEUE_TIMERWHEEL */
 struct taskqueue {
 	taskqueue_t **pprev;		/**< \e next element of the previous element (or \e children of the parent) */
 	taskqueue_t *next;		/**< Next sibling in the heap */
@@ -23,6 +71,9 @@ struct taskqueue {
 	void (*function)(void*);
 	void (*cleanup)(void*);
 	void *data;
+
+	bool keyed;
+	taskqueue_key_t key;
 };
 
 /** Checks if an element is currently part of a priority queue */
@@ -30,6 +81,13 @@ static inline bool taskqueue_linked(taskqueue_t *elem) {
 	return elem->pprev;
 }
 
+/** Builds a task key from \e len bytes at \e id */
+static inline taskqueue_key_t taskqueue_key(uint32_t type, const void *id, size_t len) {
+	taskqueue_key_t key = { .type = type };
+	memcpy(key.id, id, len < sizeof(key.id) ? len : sizeof(key.id));
+	return key;
+}
+
 void taskqueue_insert(taskqueue_t **queue, taskqueue_t *elem);
 void taskqueue_remove(taskqueue_t *elem);
 
@@ -38,3 +96,6 @@ void taskqueue_run(taskqueue_ctx *ctx);
 void taskqueue_schedule(taskqueue_ctx *ctx);
 taskqueue_t * post_task(taskqueue_ctx *ctx, unsigned int timeout, unsigned int millisecs, void (*function)(void*), void (*cleanup)(void*), void *data);
 bool reschedule_task(taskqueue_ctx *ctx, taskqueue_t *task, unsigned int timeout, unsigned int millisecs);
+taskqueue_t * post_keyed_task(taskqueue_ctx *ctx, const taskqueue_key_t *key, enum taskqueue_post_mode mode, unsigned int timeout, unsigned int millisecs, void (*function)(void*), void (*cleanup)(void*), void *data);
+taskqueue_t * find_task(taskqueue_ctx *ctx, const taskqueue_key_t *key);
+bool cancel_task(taskqueue_ctx *ctx, const taskqueue_key_t *key);
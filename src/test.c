@@ -27,6 +27,11 @@
 
 #include "version.h"
 #include "vector.h"
+#include "hashmap.h"
+#include "slab.h"
+#include "taskqueue.h"
+#include "timerwheel.h"
+#include "timespec.h"
 #include "ipmgr.h"
 #include "error.h"
 #include "icmp6.h"
@@ -40,6 +45,7 @@
 #include "alloc.h"
 #include "util.h"
 #include "packet.h"
+#include "random.h"
 #include "icmp6.h"
 
 #define SIGTERM_MSG "Exiting. Removing routes for prefixes and clients.\n"
@@ -84,6 +90,443 @@ int test_vector_init() {
 	return 0;
 }
 
+int test_hashmap() {
+	hashmap_t map;
+	hashmap_init(&map, sizeof(uint64_t), sizeof(int), hashmap_hash_u64);
+
+	for (uint64_t k = 0; k < 1000; k++) {
+		int v = k * 2;
+		hashmap_put(&map, &k, &v);
+	}
+	_assert(HASHMAP_LEN(map) == 1000);
+
+	// remove every other key so entries have to be shifted back
+	for (uint64_t k = 0; k < 1000; k += 2)
+		_assert(hashmap_remove(&map, &k));
+	_assert(HASHMAP_LEN(map) == 500);
+
+	for (uint64_t k = 0; k < 1000; k++) {
+		int *v = hashmap_get(&map, &k);
+		if (k % 2)
+			_assert(v && *v == k * 2);
+		else
+			_assert(v == NULL);
+	}
+
+	uint64_t k = 1;
+	_assert(!hashmap_remove(&map, &(uint64_t){ 2 }));
+	_assert(*(int*)hashmap_put(&map, &k, NULL) == 2);
+
+	hashmap_free(&map);
+	_assert(hashmap_get(&map, &k) == NULL);
+	return 0;
+}
+
+int test_slab() {
+	slab_t slab;
+	slab_handle_t first, h;
+	slab_init(&slab, sizeof(uint64_t));
+
+	uint64_t *p = slab_alloc(&slab, &first);
+	*p = 42;
+	for (int i = 0; i < 100; i++)
+		slab_alloc(&slab, NULL);
+	_assert(SLAB_LEN(slab) == 101);
+	// growing must not move existing elements
+	_assert(slab_resolve(&slab, first) == p && *p == 42);
+
+	slab_free(&slab, first.index);
+	_assert(slab_get(&slab, first.index) == NULL);
+
+	// the slot is reused, but the old handle stays stale
+	_assert(slab_alloc(&slab, &h) == p && *p == 0);
+	_assert(h.index == first.index);
+	_assert(!SLAB_HANDLE_EQ(h, first));
+	_assert(slab_resolve(&slab, first) == NULL);
+	_assert(slab_resolve(&slab, h) == p);
+	return 0;
+}
+
+int test_pool() {
+	l3roamd_pool_t pool;
+	void *elems[10];
+	l3roamd_pool_init(&pool, "test", 20, 4);
+	_assert(pool.elemsize == 32);
+
+	for (int i = 0; i < 10; i++) {
+		elems[i] = l3roamd_pool_alloc(&pool);
+		_assert(((uintptr_t)elems[i] & 15) == 0);
+		memset(elems[i], i, 20);
+	}
+	_assert(pool.allocated == 12 && pool.high_water == 10);
+
+	l3roamd_pool_free(&pool, elems[3]);
+	_assert(l3roamd_pool_alloc(&pool) == elems[3]);
+
+	for (int i = 0; i < 10; i++)
+		l3roamd_pool_free(&pool, elems[i]);
+	_assert(pool.in_use == 0 && pool.high_water == 10 && pool.allocated == 12);
+	return 0;
+}
+
+static int cleanups;
+
+static void count_cleanup(void *d) {
+	cleanups++;
+}
+
+static void noop_task(void *d) {
+}
+
+int test_keyed_tasks() {
+	taskqueue_ctx ctx = {};
+	taskqueue_init(&ctx);
+	struct in6_addr addr = {};
+	inet_pton(AF_INET6, "2001:db8::1", &addr);
+	taskqueue_key_t key = taskqueue_key(TASK_KEY_NS, &addr, sizeof(addr));
+	cleanups = 0;
+
+	taskqueue_t *task = post_keyed_task(&ctx, &key, TASK_MERGE, 10, 0, noop_task, count_cleanup, NULL);
+	_assert(find_task(&ctx, &key) == task);
+
+	// merging keeps the pending task, moves it forward and releases the new data
+	struct timespec due = task->due;
+	_assert(post_keyed_task(&ctx, &key, TASK_MERGE, 1, 0, noop_task, count_cleanup, NULL) == task);
+	_assert(cleanups == 1);
+	_assert(timespec_cmp(task->due, due) < 0);
+
+	taskqueue_t *replaced = post_keyed_task(&ctx, &key, TASK_REPLACE, 1, 0, noop_task, count_cleanup, NULL);
+	_assert(cleanups == 2);
+	_assert(find_task(&ctx, &key) == replaced);
+
+	_assert(cancel_task(&ctx, &key));
+	_assert(cleanups == 3);
+	_assert(find_task(&ctx, &key) == NULL);
+	_assert(!cancel_task(&ctx, &key));
+
+	close(ctx.fd);
+	return 0;
+}
+
+static int runs;
+
+static void reschedule_once_task(void *d) {
+	taskqueue_ctx *ctx = d;
+	if (++runs == 1)
+		reschedule_task(ctx, ctx->running, 0, 0);
+}
+
+int test_reschedule_running() {
+	taskqueue_ctx ctx = {};
+	taskqueue_init(&ctx);
+	runs = cleanups = 0;
+
+	post_task(&ctx, 0, 0, reschedule_once_task, count_cleanup, &ctx);
+
+	// a task that rescheduled itself is kept along with its data
+	usleep(2000);
+	taskqueue_run(&ctx);
+	_assert(runs == 1);
+	_assert(cleanups == 0);
+
+	usleep(2000);
+	taskqueue_run(&ctx);
+	_assert(runs == 2);
+	_assert(cleanups == 1);
+
+	close(ctx.fd);
+	return 0;
+}
+
+int test_chacha20() {
+	// RFC 8439, section 2.3.2: block counter 1 and nonce 00:00:00:09:00:00:00:4a:00:00:00:00
+	uint32_t key[8], out[16];
+	for (int i = 0; i < 8; i++)
+		key[i] = (4*i) | (4*i + 1) << 8 | (4*i + 2) << 16 | (uint32_t)(4*i + 3) << 24;
+
+	chacha20_block(out, key, 1 | (uint64_t)0x09000000 << 32, 0x4a000000);
+	_assert(out[0] == 0xe4e7f110);
+	_assert(out[1] == 0x15593bd1);
+	_assert(out[15] == 0x4e3c50a2);
+
+	uint8_t a[40], b[40];
+	random_bytes(a, sizeof(a));
+	random_bytes(b, sizeof(b));
+	_assert(memcmp(a, b, sizeof(a)));
+
+	return 0;
+}
+
+int test_recently_seen() {
+	intercom_ctx ctx = {};
+	intercom_init(&ctx);
+	ctx.recent_max = 2;
+
+	intercom_packet_hdr a = { .type = INTERCOM_SEEK, .nonce = 1 };
+	intercom_packet_hdr b = { .type = INTERCOM_SEEK, .nonce = 2 };
+	intercom_packet_hdr c = { .type = INTERCOM_CLAIM, .nonce = 1 };
+
+	// a retry of the same packet takes another slot
+	intercom_recently_seen_add(&ctx, &a);
+	intercom_recently_seen_add(&ctx, &a);
+	intercom_recently_seen_add(&ctx, &b);
+	_assert(intercom_recently_seen(&ctx, &a));
+	_assert(intercom_recently_seen(&ctx, &b));
+	_assert(!intercom_recently_seen(&ctx, &c));
+
+	intercom_recently_seen_add(&ctx, &c);
+	_assert(!intercom_recently_seen(&ctx, &a));
+	_assert(intercom_recently_seen(&ctx, &b));
+	_assert(intercom_recently_seen(&ctx, &c));
+
+	b.sender[0] = 1;
+	_assert(!intercom_recently_seen(&ctx, &b));
+	return 0;
+}
+
+int test_info_segments() {
+	struct client client = {}, parsed = {};
+	uint8_t packet[INTERCOM_PACKET_MAX];
+
+	// no two addresses share a prefix
+	for (int i = 0; i < 40; i++) {
+		struct client_ip ip = { .state = IP_ACTIVE };
+		ip.addr.s6_addr[0] = i;
+		VECTOR_ADD(client.addresses, ip);
+	}
+
+	int len = assemble_basicinfo(packet, &client, true);
+	_assert(len == 3 * 8 + 40 * sizeof(intercom_packet_info_entry));
+
+	for (int offset = 0; offset < len; offset += packet[offset + 1]) {
+		_assert(packet[offset] == INFO_BASIC);
+		parse_basic(&packet[offset], &parsed);
+	}
+
+	_assert(VECTOR_LEN(parsed.addresses) == 40);
+	_assert(VECTOR_INDEX(parsed.addresses, 39).addr.s6_addr[0] == 39);
+
+	VECTOR_FREE(client.addresses);
+	VECTOR_FREE(parsed.addresses);
+	return 0;
+}
+
+int test_info_prefixed() {
+	struct client client = {}, parsed = {};
+	uint8_t packet[INTERCOM_PACKET_MAX];
+	struct client_ip ip = { .state = IP_ACTIVE };
+
+	// 30 addresses in a /64, more than a prefixed segment takes
+	inet_pton(AF_INET6, "2001:db8::", &ip.addr);
+	for (int i = 0; i < 30; i++) {
+		ip.addr.s6_addr[8] = i;
+		VECTOR_ADD(client.addresses, ip);
+	}
+
+	// 3 addresses in a /96 and a single one
+	inet_pton(AF_INET6, "::ffff:10.0.0.0", &ip.addr);
+	for (int i = 0; i < 3; i++) {
+		ip.addr.s6_addr[15] = i;
+		VECTOR_ADD(client.addresses, ip);
+	}
+	inet_pton(AF_INET6, "fe80::1", &ip.addr);
+	VECTOR_ADD(client.addresses, ip);
+
+	// without the option all of them go into basic segments
+	int len = assemble_basicinfo(packet, &client, false);
+	for (int offset = 0; offset < len; offset += packet[offset + 1])
+		_assert(packet[offset] == INFO_BASIC);
+
+	len = assemble_basicinfo(packet, &client, true);
+	_assert(len < 34 * sizeof(intercom_packet_info_entry));
+
+	int prefixed = 0;
+	for (int offset = 0; offset < len; offset += packet[offset + 1]) {
+		if (packet[offset] == INFO_PREFIXED) {
+			prefixed++;
+			parse_prefixed(&packet[offset], &parsed);
+		} else {
+			_assert(packet[offset] == INFO_BASIC);
+			parse_basic(&packet[offset], &parsed);
+		}
+	}
+
+	_assert(prefixed == 3);
+	_assert(VECTOR_LEN(parsed.addresses) == 34);
+
+	for (int i = 0; i < 34; i++) {
+		struct in6_addr *addr = &VECTOR_INDEX(client.addresses, i).addr;
+		bool found = false;
+		for (int j = 0; j < 34; j++)
+			found |= !memcmp(addr, &VECTOR_INDEX(parsed.addresses, j).addr, sizeof(*addr));
+		_assert(found);
+	}
+
+	VECTOR_FREE(client.addresses);
+	VECTOR_FREE(parsed.addresses);
+	return 0;
+}
+
+int test_peer_hops() {
+	intercom_ctx ctx = {};
+	intercom_packet_hdr hdr;
+	struct in6_addr sender;
+
+	taskqueue_init(&l3ctx.taskqueue_ctx);
+	hashmap_init(&ctx.peers, sizeof(struct in6_addr), sizeof(struct intercom_peer), NULL);
+	inet_pton(AF_INET6, "2001:db8::1", &sender);
+
+	// a multicast packet relayed by two nodes
+	assemble_header(&hdr, 255, INTERCOM_SEEK);
+	memcpy(hdr.sender, &sender, sizeof(sender));
+	hdr.ttl = 253;
+	intercom_peer_seen(&ctx, &hdr);
+	_assert(((struct intercom_peer*)hashmap_get(&ctx.peers, &sender))->hops == 3);
+
+	// a unicast INFO, as intercom_info() sends it
+	assemble_header(&hdr, 1, INTERCOM_INFO);
+	memcpy(hdr.sender, &sender, sizeof(sender));
+	intercom_peer_seen(&ctx, &hdr);
+	_assert(((struct intercom_peer*)hashmap_get(&ctx.peers, &sender))->hops == 1);
+
+	hashmap_free(&ctx.peers);
+	return 0;
+}
+
+int test_shared_address() {
+	struct client_ip ip = { .state = IP_INACTIVE };
+	struct client *found = NULL;
+
+	taskqueue_init(&l3ctx.taskqueue_ctx);
+	clientmgr_init();
+	inet_pton(AF_INET6, "2001:db8::1", &ip.addr);
+
+	struct client *a = get_or_create_client((uint8_t*)"\x02\x00\x00\x00\x00\x01", 1);
+	struct client *b = get_or_create_client((uint8_t*)"\x02\x00\x00\x00\x00\x02", 1);
+	client_ip_set_state(&l3ctx.clientmgr_ctx, a, VECTOR_ADD(a->addresses, ip), IP_INACTIVE);
+	client_ip_set_state(&l3ctx.clientmgr_ctx, b, VECTOR_ADD(b->addresses, ip), IP_INACTIVE);
+
+	_assert(clientmgr_is_known_address(&l3ctx.clientmgr_ctx, &ip.addr, &found) && found == a);
+
+	// the other client still holds the address once the indexed one dropped it
+	delete_client_ip(a, &ip.addr, true);
+	_assert(clientmgr_is_known_address(&l3ctx.clientmgr_ctx, &ip.addr, &found) && found == b);
+
+	delete_client_ip(b, &ip.addr, true);
+	_assert(!clientmgr_is_known_address(&l3ctx.clientmgr_ctx, &ip.addr, NULL));
+	return 0;
+}
+
+int test_sendq_priority() {
+	intercom_ctx ctx = { .mtu = 1500 };
+	intercom_if_t mesh0 = { .ifname = "mesh0", .ifindex = 1, .ok = true }, mesh1 = { .ifname = "mesh1", .ifindex = 2, .ok = true };
+	intercom_packet_hdr seek = { .type = INTERCOM_SEEK }, ack = { .type = INTERCOM_ACK };
+	struct in6_addr recipient = IN6ADDR_LOOPBACK_INIT;
+
+	VECTOR_INIT(ctx.interfaces);
+	VECTOR_INIT(ctx.sendq);
+	VECTOR_INIT(ctx.sendq_buf);
+	VECTOR_INIT(ctx.sendq_held);
+	VECTOR_ADD(ctx.interfaces, mesh0);
+	VECTOR_ADD(ctx.interfaces, mesh1);
+
+	// the queue is not bounded while the socket takes datagrams
+	for (int i = 0; i < 2 * INTERCOM_SENDQ_MAX; i++)
+		intercom_send_packet(&ctx, (uint8_t*)&seek, sizeof(seek));
+	_assert(VECTOR_LEN(ctx.sendq) == 4 * INTERCOM_SENDQ_MAX);
+	_assert(ctx.stats.send_dropped == 0);
+
+	VECTOR_RESIZE(ctx.sendq, 0);
+	VECTOR_RESIZE(ctx.sendq_buf, 0);
+	ctx.sendq_blocked = true;
+
+	for (int i = 0; i < INTERCOM_SENDQ_MAX; i++)
+		intercom_send_packet(&ctx, (uint8_t*)&seek, sizeof(seek));
+	_assert(VECTOR_LEN(ctx.sendq) == 2 * INTERCOM_SENDQ_MAX);
+
+	// a full interface makes room for an ACK but not for another SEEK
+	intercom_send_packet(&ctx, (uint8_t*)&ack, sizeof(ack));
+	intercom_send_packet(&ctx, (uint8_t*)&seek, sizeof(seek));
+	_assert(VECTOR_LEN(ctx.sendq) == 2 * INTERCOM_SENDQ_MAX);
+	_assert(ctx.stats.send_dropped == 4);
+
+	// a unicast recipient has a bound of its own
+	_assert(intercom_send_packet_unicast(&ctx, &recipient, (uint8_t*)&seek, sizeof(seek)));
+	_assert(VECTOR_LEN(ctx.sendq) == 2 * INTERCOM_SENDQ_MAX + 1);
+	_assert(ctx.stats.send_dropped == 4);
+
+	int acks = 0;
+	for (int i = 0; i < VECTOR_LEN(ctx.sendq); i++) {
+		struct intercom_queued_packet *q = &VECTOR_INDEX(ctx.sendq, i);
+		if (((intercom_packet_hdr*)&VECTOR_INDEX(ctx.sendq_buf, q->offset))->type == INTERCOM_ACK)
+			acks++;
+	}
+	_assert(acks == 2);
+
+	// an interface with a full queue is held back on its own
+	struct intercom_destination held = { .ifindex = mesh0.ifindex };
+	VECTOR_RESIZE(ctx.sendq, 0);
+	VECTOR_RESIZE(ctx.sendq_buf, 0);
+	VECTOR_ADD(ctx.sendq_held, held);
+	ctx.sendq_blocked = false;
+	ctx.stats.send_dropped = 0;
+
+	for (int i = 0; i <= INTERCOM_SENDQ_MAX; i++)
+		intercom_send_packet(&ctx, (uint8_t*)&seek, sizeof(seek));
+	_assert(VECTOR_LEN(ctx.sendq) == 2 * INTERCOM_SENDQ_MAX + 1);
+	_assert(ctx.stats.send_dropped == 1);
+
+	VECTOR_FREE(ctx.interfaces);
+	VECTOR_FREE(ctx.sendq);
+	VECTOR_FREE(ctx.sendq_buf);
+	VECTOR_FREE(ctx.sendq_held);
+	return 0;
+}
+
+int test_timerwheel() {
+	timerwheel_t wheel;
+	// due ticks on every level and on the overflow list, not in order
+	uint64_t due[] = { 1005, 71000, 1000, 20000000, 1064, 1003, 5000 };
+	int n = sizeof(due) / sizeof(due[0]);
+	taskqueue_t tasks[n];
+
+	timerwheel_init(&wheel, 1000);
+	memset(tasks, 0, sizeof(tasks));
+	for (int i = 0; i < n; i++) {
+		tasks[i].due.tv_sec = due[i] / 1000;
+		tasks[i].due.tv_nsec = (due[i] % 1000) * 1000000;
+		timerwheel_insert(&wheel, &tasks[i]);
+	}
+	_assert(TIMERWHEEL_LEN(wheel) == n);
+
+	// the task due at the current tick is expired right away
+	_assert(timerwheel_next(&wheel) == 1000);
+	_assert(timerwheel_pop(&wheel) == &tasks[2]);
+	_assert(timerwheel_pop(&wheel) == NULL);
+
+	timerwheel_remove(&wheel, &tasks[5]);
+	_assert(!taskqueue_linked(&tasks[5]));
+
+	timerwheel_advance(&wheel, 1004);
+	_assert(timerwheel_pop(&wheel) == NULL);
+	_assert(timerwheel_next(&wheel) == 1005);
+
+	uint64_t expected[] = { 1005, 1064, 5000, 71000, 20000000 };
+	for (int i = 0; i < 5; i++) {
+		while (timerwheel_next(&wheel) < expected[i])
+			timerwheel_advance(&wheel, timerwheel_next(&wheel));
+		_assert(timerwheel_next(&wheel) == expected[i]);
+
+		timerwheel_advance(&wheel, expected[i]);
+		taskqueue_t *task = timerwheel_pop(&wheel);
+		_assert(task && timerwheel_tick(&task->due) == expected[i]);
+	}
+
+	_assert(TIMERWHEEL_LEN(wheel) == 0);
+	_assert(timerwheel_next(&wheel) == UINT64_MAX);
+	return 0;
+}
+
 int test_ntohl_ipv4() {
 	struct in_addr address;
 	inet_pton(AF_INET, "1.2.3.4", &address );
@@ -134,6 +577,19 @@ int test_icmp_dest_unreachable4() {
 
 int all_tests() {
 	_verify(test_vector_init);
+	_verify(test_hashmap);
+	_verify(test_slab);
+	_verify(test_pool);
+	_verify(test_timerwheel);
+	_verify(test_keyed_tasks);
+	_verify(test_reschedule_running);
+	_verify(test_chacha20);
+	_verify(test_recently_seen);
+	_verify(test_info_segments);
+	_verify(test_info_prefixed);
+	_verify(test_peer_hops);
+	_verify(test_shared_address);
+	_verify(test_sendq_priority);
 	_verify(test_ntohl_ipv4);
 	_verify(test_mac);
 	_verify(test_icmp_dest_unreachable4);
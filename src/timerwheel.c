@@ -0,0 +1,207 @@
+/**
+   \file
+
+   Hierarchical timing wheel for scheduled tasks
+
+   A task is stored on the lowest level whose slot index is the only part of
+   its due tick that differs from the current tick, i.e. level 0 if it is due
+   within the current block of 64 ticks, level 1 if it is due within the
+   current block of 4096 ticks and so on. Advancing the wheel jumps directly
+   to the next occupied slot: slots of level 0 hold tasks that are due at
+   exactly that tick, slots of higher levels are cascaded to lower levels once
+   the current tick reaches them.
+*/
+
+
+#include "timerwheel.h"
+#include "taskqueue.h"
+#include "error.h"
+
+#include <string.h>
+
+
+#define MASK (TIMERWHEEL_SLOTS - 1)
+
+/** The number of low tick bits covered by a slot of \e level */
+#define SHIFT(level) ((level) * TIMERWHEEL_BITS)
+
+
+/** Converts a point in time to a tick, rounding up so tasks never run early */
+uint64_t timerwheel_tick(const struct timespec *t) {
+	return (uint64_t)t->tv_sec * 1000 + (t->tv_nsec + 999999) / 1000000;
+}
+
+void timerwheel_init(timerwheel_t *wheel, uint64_t now) {
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = now;
+}
+
+static inline void list_link(taskqueue_t **list, taskqueue_t *elem) {
+	elem->pprev = list;
+	elem->next = *list;
+	if (elem->next)
+		elem->next->pprev = &elem->next;
+
+	*list = elem;
+}
+
+static inline void list_unlink(taskqueue_t *elem) {
+	*elem->pprev = elem->next;
+	if (elem->next)
+		elem->next->pprev = elem->pprev;
+
+	elem->pprev = NULL;
+	elem->next = NULL;
+}
+
+/** Links a task into the slot matching its due tick, relative to the current tick */
+static void place(timerwheel_t *wheel, taskqueue_t *elem) {
+	uint64_t tick = timerwheel_tick(&elem->due);
+
+	if (tick <= wheel->now) {
+		list_link(&wheel->expired, elem);
+		return;
+	}
+
+	for (int level = 0; level < TIMERWHEEL_LEVELS; level++) {
+		if ((tick >> SHIFT(level + 1)) == (wheel->now >> SHIFT(level + 1))) {
+			int slot = (tick >> SHIFT(level)) & MASK;
+			list_link(&wheel->slots[level][slot], elem);
+			wheel->occupied[level] |= 1ull << slot;
+			return;
+		}
+	}
+
+	list_link(&wheel->overflow, elem);
+}
+
+/** Inserts a task. The task must not be linked. */
+void timerwheel_insert(timerwheel_t *wheel, taskqueue_t *elem) {
+	if (elem->pprev || elem->next || elem->children)
+		exit_bug("timerwheel_insert: tried to insert linked task");
+
+	place(wheel, elem);
+	wheel->length++;
+}
+
+/**
+   Removes a task from the wheel. Nothing happens if the task is not linked.
+
+   The occupation bit of the slot is left set; it is cleared lazily when the
+   slot is found empty.
+*/
+void timerwheel_remove(timerwheel_t *wheel, taskqueue_t *elem) {
+	if (!taskqueue_linked(elem))
+		return;
+
+	list_unlink(elem);
+	wheel->length--;
+}
+
+/**
+   Finds the next slot to process
+
+   Returns the tick at which the slot is reached and stores its level in
+   \e level. A level of TIMERWHEEL_LEVELS means the overflow list.
+*/
+static uint64_t next_slot(timerwheel_t *wheel, int *level) {
+	uint64_t best = UINT64_MAX;
+
+	for (int l = 0; l < TIMERWHEEL_LEVELS; l++) {
+		int current = (wheel->now >> SHIFT(l)) & MASK;
+		uint64_t pending = wheel->occupied[l] & (~0ull << current);
+
+		while (pending) {
+			int slot = __builtin_ctzll(pending);
+
+			if (!wheel->slots[l][slot]) {
+				wheel->occupied[l] &= ~(1ull << slot);
+				pending &= pending - 1;
+				continue;
+			}
+
+			uint64_t base = wheel->now >> SHIFT(l + 1) << SHIFT(l + 1);
+			uint64_t tick = base | ((uint64_t)slot << SHIFT(l));
+			if (tick < wheel->now)
+				tick = wheel->now;
+
+			if (tick < best) {
+				best = tick;
+				*level = l;
+			}
+			break;
+		}
+	}
+
+	if (wheel->overflow && best == UINT64_MAX) {
+		best = ((wheel->now >> SHIFT(TIMERWHEEL_LEVELS)) + 1) << SHIFT(TIMERWHEEL_LEVELS);
+		*level = TIMERWHEEL_LEVELS;
+	}
+
+	return best;
+}
+
+/**
+   Returns the tick at which the wheel has to be advanced next
+
+   Due tasks are available immediately. Otherwise this is either the tick a
+   task is due at or the tick at which tasks have to be cascaded to a lower
+   level. Returns UINT64_MAX if the wheel is empty.
+*/
+uint64_t timerwheel_next(timerwheel_t *wheel) {
+	if (wheel->expired)
+		return wheel->now;
+
+	int level;
+	return next_slot(wheel, &level);
+}
+
+/** Advances the wheel to the tick \e now, moving all tasks that are due by then to the expired list */
+void timerwheel_advance(timerwheel_t *wheel, uint64_t now) {
+	while (true) {
+		int level;
+		uint64_t tick = next_slot(wheel, &level);
+
+		if (tick > now)
+			break;
+
+		wheel->now = tick;
+
+		taskqueue_t **list;
+		if (level < TIMERWHEEL_LEVELS) {
+			int slot = (tick >> SHIFT(level)) & MASK;
+			list = &wheel->slots[level][slot];
+			wheel->occupied[level] &= ~(1ull << slot);
+		}
+		else {
+			list = &wheel->overflow;
+		}
+
+		// detach the list first, tasks from the overflow list may end up there again
+		taskqueue_t *elem = *list;
+		*list = NULL;
+
+		while (elem) {
+			taskqueue_t *next = elem->next;
+			elem->pprev = NULL;
+			elem->next = NULL;
+			place(wheel, elem);
+			elem = next;
+		}
+	}
+
+	if (now > wheel->now)
+		wheel->now = now;
+}
+
+/** Removes a due task from the wheel and returns it, or returns NULL if no task is due */
+taskqueue_t * timerwheel_pop(timerwheel_t *wheel) {
+	taskqueue_t *elem = wheel->expired;
+
+	if (elem) {
+		list_unlink(elem);
+		wheel->length--;
+	}
+
+	return elem;
+}
@@ -0,0 +1,56 @@
+/**
+   \file
+
+   Hierarchical timing wheel for scheduled tasks
+
+   Time is counted in ticks of one millisecond. Each level has 64 slots, a
+   slot of level \e n covering 64^n ticks, so four levels cover about 4.6
+   hours ahead; tasks that are due later are kept on an overflow list that is
+   sorted into the wheel once its time range is reached. Tasks are linked into
+   the slots through the \e pprev and \e next members of taskqueue_t, so
+   inserting and removing a task is O(1) and needs no allocation.
+*/
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+#define TIMERWHEEL_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_BITS)
+#define TIMERWHEEL_LEVELS 4
+
+
+typedef struct taskqueue taskqueue_t;
+
+/** A timing wheel descriptor */
+typedef struct timerwheel {
+	uint64_t now;					/**< The current tick */
+	size_t length;					/**< The number of linked tasks */
+	uint64_t occupied[TIMERWHEEL_LEVELS];		/**< Slots that may hold tasks, one bit per slot */
+	taskqueue_t *slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+	taskqueue_t *overflow;				/**< Tasks that are due beyond the range of the wheel */
+	taskqueue_t *expired;				/**< Tasks that are due */
+} timerwheel_t;
+
+
+uint64_t timerwheel_tick(const struct timespec *t);
+
+void timerwheel_init(timerwheel_t *wheel, uint64_t now);
+void timerwheel_insert(timerwheel_t *wheel, taskqueue_t *elem);
+void timerwheel_remove(timerwheel_t *wheel, taskqueue_t *elem);
+uint64_t timerwheel_next(timerwheel_t *wheel);
+void timerwheel_advance(timerwheel_t *wheel, uint64_t now);
+taskqueue_t * timerwheel_pop(timerwheel_t *wheel);
+
+
+/**
+   Returns the number of tasks in the wheel \e w
+
+   \hideinitializer
+*/
+#define TIMERWHEEL_LEN(w) ((w).length)
@@ -88,6 +88,19 @@ void add_fd ( int efd, int fd, uint32_t events )
     }
 }
 
+void mod_fd ( int efd, int fd, uint32_t events )
+{
+    struct epoll_event event = {};
+    event.data.fd = fd;
+    event.events = events;
+
+    int s = epoll_ctl ( efd, EPOLL_CTL_MOD, fd, &event );
+    if ( s == -1 ) {
+        perror ( "epoll_ctl (MOD):" );
+        exit_error ( "epoll_ctl" );
+    }
+}
+
 void del_fd ( int efd, int fd )
 {
     int s = epoll_ctl ( efd, EPOLL_CTL_DEL, fd, NULL );
@@ -13,6 +13,7 @@ void log_debug(const char *format, ...);
 void log_error(const char *format, ...);
 
 void add_fd ( int efd, int fd, uint32_t events );
+void mod_fd ( int efd, int fd, uint32_t events );
 void del_fd ( int efd, int fd );
 void interfaces_changed ( int type, const struct ifinfomsg *msg );
 